@@ -0,0 +1,249 @@
+#include "Lox.hpp"
+#include "PerfCounters.hpp"
+#include "SourceFile.hpp"
+
+#include <fmt/format.h>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <system_error>
+#include <filesystem>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// End-to-end benchmark runner. Every run of a script happens in a forked
+// child so peak RSS and allocation counts belong to that run alone; the child
+// reports its measurements back over a pipe and the parent prints one JSON
+// document for the whole corpus.
+
+// Directory scanned for *.lox scripts when none are named on the command
+// line. Set by CMake to the source tree's bench/ directory.
+#ifndef LOX_BENCH_DIR
+#define LOX_BENCH_DIR "bench"
+#endif
+
+namespace {
+std::size_t allocations = 0;
+std::size_t allocatedBytes = 0;
+}
+
+auto operator new(std::size_t size) -> void* {
+  allocations++;
+  allocatedBytes += size;
+  if (auto* memory = std::malloc(size == 0 ? 1 : size)) return memory;
+  throw std::bad_alloc{};
+}
+
+// Kept out of line: once inlined, GCC pairs the free() with the operator new
+// call at the allocation site and warns about a mismatch.
+[[gnu::noinline]] auto operator delete(void* memory) noexcept -> void {
+  std::free(memory);
+}
+
+[[gnu::noinline]] auto operator delete(void* memory, std::size_t) noexcept -> void {
+  std::free(memory);
+}
+
+namespace {
+struct Sample {
+  double milliseconds = {};
+  std::size_t allocations = {};
+  std::size_t allocatedBytes = {};
+  long peakRssKb = {};
+  lox::PerfCounters::Sample counters = {};
+};
+
+struct Result {
+  std::string name = {};
+  std::vector<Sample> samples = {};
+};
+
+auto measure(std::string_view source, const lox::Options& options, bool perfCounters) -> std::optional<Sample> {
+  using namespace std;
+
+  int fds[2];
+  if (pipe(fds) != 0) return {};
+
+  auto&& pid = fork();
+  if (pid < 0) return {};
+
+  if (pid == 0) {
+    close(fds[0]);
+    if (auto&& null = open("/dev/null", O_WRONLY); null >= 0) dup2(null, STDOUT_FILENO);
+
+    auto&& perf = perfCounters ? lox::PerfCounters::open() : lox::PerfCounters{};
+    auto&& counters = lox::PerfCounters::Sample{};
+
+    allocations = 0;
+    allocatedBytes = 0;
+    auto&& start = chrono::steady_clock::now();
+    perf.measure(counters, [&] { lox::run(source, options); });
+    auto&& elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start);
+
+    auto&& sample = Sample{elapsed.count(), allocations, allocatedBytes, {}, counters};
+    auto&& written = write(fds[1], &sample, sizeof sample);
+    _exit(written == sizeof sample ? 0 : 1);
+  }
+
+  close(fds[1]);
+  auto&& sample = Sample{};
+  auto&& received = read(fds[0], &sample, sizeof sample);
+  close(fds[0]);
+
+  auto&& status = 0;
+  auto&& usage = rusage{};
+  if (wait4(pid, &status, 0, &usage) != pid || received != sizeof sample) return {};
+
+  sample.peakRssKb = usage.ru_maxrss;
+  return sample;
+}
+
+auto parseRuns(std::string_view text, std::size_t& runs) -> bool {
+  auto&& value = std::size_t{};
+  auto&& [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+  if (ec != std::errc{} || end != text.data() + text.size() || value == 0) return false;
+
+  runs = value;
+  return true;
+}
+
+// Nearest-rank percentile of an ascending sequence.
+auto percentile(const std::vector<double>& sorted, double p) -> double {
+  auto&& rank = static_cast<std::size_t>(p / 100.0 * static_cast<double>(sorted.size()) + 0.5);
+  return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+}
+
+auto corpus(const std::filesystem::path& directory) -> std::vector<std::filesystem::path> {
+  using namespace std;
+
+  auto&& scripts = vector<filesystem::path>{};
+  for (auto&& entry: filesystem::directory_iterator{directory}) {
+    if (entry.path().extension() == ".lox") scripts.push_back(entry.path());
+  }
+  ranges::sort(scripts);
+  return scripts;
+}
+
+// Median of each hardware counter across runs, or null where the counter
+// could not be read.
+auto counters(const std::vector<Sample>& samples) -> std::string {
+  using namespace fmt;
+  using namespace std;
+
+  auto&& json = string{"{"};
+  for (size_t i = 0; i < lox::PerfCounters::EVENT_COUNT; i++) {
+    auto&& values = vector<double>{};
+    for (auto&& sample: samples) {
+      if (sample.counters.valid[i]) values.push_back(static_cast<double>(sample.counters.values[i]));
+    }
+    ranges::sort(values);
+
+    json += format("{}\"{}\": ", i == 0 ? "" : ", ", lox::PerfCounters::NAMES[i]);
+    json += values.empty() ? string{"null"} : format("{:.0f}", percentile(values, 50));
+  }
+  return json + "}";
+}
+
+auto report(const std::vector<Result>& results, const lox::Options& options, std::size_t runs, bool perfCounters) -> void {
+  using namespace fmt;
+  using namespace std;
+
+  print("{{\n");
+  print("  \"engine\": \"{}\",\n", options.engine == lox::Engine::VM ? "vm" : options.engine == lox::Engine::CLOSURE ? "closure" : "tree");
+  print("  \"stream\": {},\n", options.stream);
+  print("  \"jit\": {},\n", options.jit);
+  print("  \"runs\": {},\n", runs);
+  print("  \"benchmarks\": [");
+
+  auto separator = "";
+  for (auto&& result: results) {
+    auto&& times = vector<double>{};
+    auto&& peakRssKb = 0L;
+    for (auto&& sample: result.samples) {
+      times.push_back(sample.milliseconds);
+      peakRssKb = max(peakRssKb, sample.peakRssKb);
+    }
+    ranges::sort(times);
+
+    // Allocation counts are deterministic for a given script, so any run
+    // will do.
+    auto&& last = result.samples.back();
+    print("{}\n    {{\"name\": {:?}, \"median_ms\": {:.3f}, \"p99_ms\": {:.3f}, \"peak_rss_kb\": {}, \"allocations\": {}, \"allocated_bytes\": {}",
+      separator, result.name, percentile(times, 50), percentile(times, 99), peakRssKb, last.allocations, last.allocatedBytes);
+    if (perfCounters) print(", \"counters\": {}", counters(result.samples));
+    print("}}");
+    separator = ",";
+  }
+
+  print("\n  ]\n}}\n");
+}
+}
+
+auto main(int argc, char** argv) -> int {
+  using namespace fmt;
+
+  auto&& options = lox::Options{};
+  auto&& runs = std::size_t{10};
+  auto&& perfCounters = false;
+  auto&& args = 1;
+  for (; args < argc && std::string_view{argv[args]}.starts_with("--"); args++) {
+    auto&& option = std::string_view{argv[args]};
+    if (option == "--engine=vm") {
+      options.engine = lox::Engine::VM;
+    } else if (option == "--engine=tree") {
+      options.engine = lox::Engine::TREE;
+    } else if (option == "--engine=closure") {
+      options.engine = lox::Engine::CLOSURE;
+    } else if (option == "--stream") {
+      options.stream = true;
+    } else if (option == "--jit") {
+      options.jit = true;
+    } else if (option == "--perf-counters") {
+      perfCounters = true;
+    } else if (option.starts_with("--runs=") && parseRuns(option.substr(7), runs)) {
+      // parseRuns() has stored the count.
+    } else {
+      print(stderr, "Unknown option: {}\n", option);
+      print(stderr, "Usage: lox-bench [--engine=tree|vm|closure] [--stream] [--jit] [--perf-counters] [--runs=N] [script...]\n");
+      return 64;
+    }
+  }
+
+  auto&& scripts = std::vector<std::filesystem::path>(argv + args, argv + argc);
+  if (scripts.empty()) scripts = corpus(LOX_BENCH_DIR);
+
+  auto&& results = std::vector<Result>{};
+  for (auto&& script: scripts) {
+    auto&& source = lox::SourceFile::open(script.c_str());
+    if (!source) {
+      print(stderr, "Could not open {}\n", script.string());
+      return 66;
+    }
+
+    auto&& result = Result{script.stem().string()};
+    for (std::size_t i = 0; i < runs; i++) {
+      auto&& sample = measure(source->view(), options, perfCounters);
+      if (!sample) {
+        print(stderr, "Benchmark {} failed\n", script.string());
+        return 70;
+      }
+      result.samples.push_back(*sample);
+    }
+    results.push_back(std::move(result));
+  }
+
+  report(results, options, runs, perfCounters);
+  return 0;
+}
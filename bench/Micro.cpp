@@ -0,0 +1,296 @@
+#include "Ast.hpp"
+#include "Diagnostics.hpp"
+#include "Environment.hpp"
+#include "Interpreter.hpp"
+#include "Native.hpp"
+#include "Object.hpp"
+#include "Parser.hpp"
+#include "Resolver.hpp"
+#include "Scanner.hpp"
+#include "Symbol.hpp"
+#include "TokenType.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+// Component microbenchmarks. Every benchmark reports the heap traffic of its
+// timed region as allocs/op and bytes/op next to the usual ns/op, so a change
+// that starts allocating on a hot path shows up even when it is not slower.
+
+namespace {
+std::size_t allocations = 0;
+std::size_t allocatedBytes = 0;
+bool counting = true;
+}
+
+auto operator new(std::size_t size) -> void* {
+  if (counting) {
+    allocations++;
+    allocatedBytes += size;
+  }
+  if (auto* memory = std::malloc(size == 0 ? 1 : size)) return memory;
+  throw std::bad_alloc{};
+}
+
+// Kept out of line: once inlined, GCC pairs the free() with the operator new
+// call at the allocation site and warns about a mismatch.
+[[gnu::noinline]] auto operator delete(void* memory) noexcept -> void {
+  std::free(memory);
+}
+
+[[gnu::noinline]] auto operator delete(void* memory, std::size_t) noexcept -> void {
+  std::free(memory);
+}
+
+namespace {
+// Records the allocations made between construction and report().
+struct AllocationCounter {
+  std::size_t allocations = ::allocations;
+  std::size_t allocatedBytes = ::allocatedBytes;
+
+  auto report(benchmark::State& state) const -> void {
+    using enum benchmark::Counter::Flags;
+
+    // Read both totals before inserting into `counters`, which allocates.
+    auto&& count = static_cast<double>(::allocations - allocations);
+    auto&& bytes = static_cast<double>(::allocatedBytes - allocatedBytes);
+    state.counters["allocs/op"] = benchmark::Counter(count, kAvgIterations);
+    state.counters["bytes/op"] = benchmark::Counter(bytes, kAvgIterations);
+  }
+};
+
+// Runs setup work inside a timed loop without charging its time or its
+// allocations to the benchmark.
+template<typename F>
+auto untimed(benchmark::State& state, F&& setup) -> decltype(auto) {
+  state.PauseTiming();
+  counting = false;
+  decltype(auto) result = setup();
+  counting = true;
+  state.ResumeTiming();
+  return result;
+}
+
+enum class Mix: std::uint8_t {
+  IDENTIFIERS,
+  NUMBERS,
+  STRINGS,
+  OPERATORS,
+  STATEMENTS,
+};
+
+// Builds a source text of roughly `count` tokens of the given kind.
+auto synthesize(Mix mix, std::size_t count) -> std::string {
+  using enum Mix;
+
+  static constexpr std::string_view names[] = {"alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta"};
+  static constexpr std::string_view operators[] = {"+", "-", "*", "/", "==", "!=", "<=", ">=", "(", ")", "{", "}", ";", ","};
+
+  auto&& source = std::string{};
+  for (std::size_t i = 0; i < count; i++) {
+    switch (mix) {
+      case IDENTIFIERS:
+        source += names[i % std::size(names)];
+        source += std::to_string(i % 64);
+        source += ' ';
+        break;
+      case NUMBERS:
+        source += std::to_string(i * 7919 % 100000);
+        source += ".25 ";
+        break;
+      case STRINGS:
+        source += "\"string literal\" ";
+        break;
+      case OPERATORS:
+        source += operators[i % std::size(operators)];
+        source += ' ';
+        break;
+      case STATEMENTS:
+        // Nine tokens per line.
+        if (i % 9 == 0) {
+          source += "var ";
+          source += names[i / 9 % std::size(names)];
+          source += " = count + 1.5 * \"s\";\n";
+        }
+        break;
+    }
+  }
+
+  return source;
+}
+
+auto scan(std::string_view source) -> std::vector<lox::Token> {
+  auto&& symbols = lox::SymbolTable{};
+  auto&& diagnostics = lox::Diagnostics{};
+  auto&& scanner = lox::Scanner{source, symbols, diagnostics};
+  return scanner.scanTokens();
+}
+
+auto BM_ScanTokens(benchmark::State& state, Mix mix) -> void {
+  auto&& source = synthesize(mix, static_cast<std::size_t>(state.range(0)));
+
+  auto&& diagnostics = lox::Diagnostics{};
+
+  auto&& counter = AllocationCounter{};
+  for (auto _: state) {
+    auto&& symbols = lox::SymbolTable{};
+    auto&& scanner = lox::Scanner{source, symbols, diagnostics};
+    benchmark::DoNotOptimize(scanner.scanTokens());
+  }
+  counter.report(state);
+  state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(source.size()));
+}
+BENCHMARK_CAPTURE(BM_ScanTokens, identifiers, Mix::IDENTIFIERS)->Range(64, 16384);
+BENCHMARK_CAPTURE(BM_ScanTokens, numbers, Mix::NUMBERS)->Range(64, 16384);
+BENCHMARK_CAPTURE(BM_ScanTokens, strings, Mix::STRINGS)->Range(64, 16384);
+BENCHMARK_CAPTURE(BM_ScanTokens, operators, Mix::OPERATORS)->Range(64, 16384);
+BENCHMARK_CAPTURE(BM_ScanTokens, statements, Mix::STATEMENTS)->Range(64, 16384);
+
+auto BM_Parse(benchmark::State& state, const std::string& source) -> void {
+  auto&& tokens = scan(source);
+  auto&& diagnostics = lox::Diagnostics{};
+
+  auto&& counter = AllocationCounter{};
+  for (auto _: state) {
+    auto&& parser = untimed(state, [&] { return lox::Parser{diagnostics, tokens}; });
+    benchmark::DoNotOptimize(parser.parse());
+  }
+  counter.report(state);
+}
+
+// `((((1))))`: every level is a Grouping, so the parser recurses once per
+// level through the whole precedence ladder.
+auto BM_ParseDeep(benchmark::State& state) -> void {
+  auto&& depth = static_cast<std::size_t>(state.range(0));
+  BM_Parse(state, std::string(depth, '(') + "1" + std::string(depth, ')') + ";");
+}
+BENCHMARK(BM_ParseDeep)->Range(8, 512);
+
+// `1 + 1 + ... + 1`: one long left-associative chain of Binary nodes.
+auto BM_ParseWide(benchmark::State& state) -> void {
+  auto&& source = std::string{"1"};
+  for (auto i = 0; i < state.range(0); i++) source += " + 1";
+  BM_Parse(state, source + ";");
+}
+BENCHMARK(BM_ParseWide)->Range(8, 4096);
+
+// A chain of `depth` environments with the variable in the outermost one.
+auto chain(std::size_t depth) -> std::shared_ptr<lox::Environment> {
+  auto&& environment = std::make_shared<lox::Environment>();
+  environment->defineAt(0, 1.0);
+  for (std::size_t i = 0; i < depth; i++) {
+    environment = std::make_shared<lox::Environment>(environment);
+  }
+  return environment;
+}
+
+auto BM_EnvironmentGetAt(benchmark::State& state) -> void {
+  auto&& depth = static_cast<std::size_t>(state.range(0));
+  auto&& environment = chain(depth);
+
+  auto&& counter = AllocationCounter{};
+  for (auto _: state) {
+    benchmark::DoNotOptimize(environment->getAt(depth, 0));
+  }
+  counter.report(state);
+}
+BENCHMARK(BM_EnvironmentGetAt)->DenseRange(0, 8, 2)->Arg(32);
+
+auto BM_EnvironmentAssignAt(benchmark::State& state) -> void {
+  auto&& depth = static_cast<std::size_t>(state.range(0));
+  auto&& environment = chain(depth);
+  auto&& value = lox::Object{2.0};
+
+  auto&& counter = AllocationCounter{};
+  for (auto _: state) {
+    environment->assignAt(depth, 0, value);
+    benchmark::ClobberMemory();
+  }
+  counter.report(state);
+}
+BENCHMARK(BM_EnvironmentAssignAt)->DenseRange(0, 8, 2)->Arg(32);
+
+// Globals are not chained: lookup is an index into the global table.
+auto BM_EnvironmentFindGlobal(benchmark::State& state) -> void {
+  auto&& environment = lox::Environment{};
+  auto&& symbol = static_cast<lox::Symbol>(state.range(0));
+  environment.define(symbol, 1.0);
+
+  auto&& counter = AllocationCounter{};
+  for (auto _: state) {
+    benchmark::DoNotOptimize(environment.find(symbol));
+  }
+  counter.report(state);
+}
+BENCHMARK(BM_EnvironmentFindGlobal)->Arg(0)->Arg(1024);
+
+// A resolved program whose final statement is an expression. Everything
+// before it is executed once up front so it can declare what the expression
+// uses. The native `hypot` is predefined.
+struct Fixture {
+  std::string source;
+  lox::SymbolTable symbols = {};
+  lox::SyntaxTree tree = {};
+  lox::Diagnostics diagnostics = {};
+  lox::Interpreter interpreter{diagnostics};
+
+  explicit Fixture(std::string text):
+    source(std::move(text))
+  {
+    auto&& hypot = lox::Native::bind("hypot", [](double a, double b) { return std::hypot(a, b); });
+    interpreter.globals->define(symbols.intern("hypot"), lox::Ref<lox::LoxCallable>{hypot});
+
+    auto&& scanner = lox::Scanner{source, symbols, diagnostics};
+    tree = lox::Parser{diagnostics, scanner.scanTokens()}.parse();
+    lox::Resolver{diagnostics}.resolve(tree.statements);
+
+    auto&& setup = std::vector<lox::Stmt>(tree.statements.begin(), tree.statements.end() - 1);
+    interpreter.interpret(setup);
+  }
+
+  auto expression() const -> const lox::Expr& {
+    return std::get<lox::Expression*>(tree.statements.back())->expression;
+  }
+};
+
+auto BM_Evaluate(benchmark::State& state, const char* source) -> void {
+  auto&& fixture = Fixture{source};
+  auto&& expression = fixture.expression();
+  // Once outside the count, so the interpreter's argument stack and
+  // environment pool are as large as the expression needs.
+  benchmark::DoNotOptimize(fixture.interpreter.evaluate(expression));
+
+  auto&& counter = AllocationCounter{};
+  for (auto _: state) {
+    benchmark::DoNotOptimize(fixture.interpreter.evaluate(expression));
+  }
+  counter.report(state);
+}
+BENCHMARK_CAPTURE(BM_Evaluate, binary_arithmetic, "1 + 2 * 3 - 4 / 5;");
+BENCHMARK_CAPTURE(BM_Evaluate, binary_comparison, "1 < 2 == 3 >= 4;");
+BENCHMARK_CAPTURE(BM_Evaluate, binary_string, "\"left\" + \"right\";");
+BENCHMARK_CAPTURE(BM_Evaluate, binary_globals, "var a = 1; var b = 2; a + b;");
+BENCHMARK_CAPTURE(BM_Evaluate, logical, "nil or false and true or 1;");
+BENCHMARK_CAPTURE(BM_Evaluate, call_empty, "fun f() {} f();");
+BENCHMARK_CAPTURE(BM_Evaluate, call_return, "fun f(a, b) { return a + b; } f(1, 2);");
+// Steady-state calls report allocs/op=0; test/Allocations.cpp enforces it.
+BENCHMARK_CAPTURE(BM_Evaluate, call_recursive,
+  "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } fib(10);");
+BENCHMARK_CAPTURE(BM_Evaluate, call_nested_blocks,
+  "fun f(n) { { var a = n; { var b = a + 1; return f2(a, b); } } } fun f2(a, b) { return a * b; } f(3);");
+BENCHMARK_CAPTURE(BM_Evaluate, call_native, "hypot(3, 4);");
+BENCHMARK_CAPTURE(BM_Evaluate, call_closure,
+  "fun make() { var n = 0; fun inc() { n = n + 1; return n; } return inc; } var counter = make(); counter();");
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace lox {
+// Bump allocator for objects that all die together, such as the nodes of a
+// parsed program. Memory is carved out of large blocks and released in one
+// go. Only objects that need a destructor are remembered and destroyed, in
+// reverse order of construction. An object can also say at runtime that it
+// holds nothing to release, by returning false from needsDestruction().
+//
+// Syntax tree nodes are built to need nothing: tokens own no memory and
+// child lists are spans allocated here with list(). Only Literal nodes
+// holding a string are destroyed one by one.
+struct Arena {
+  struct Destructor {
+    void* object;
+    void (*destroy)(void*);
+  };
+
+  static constexpr std::size_t INITIAL_BLOCK_SIZE = 64 * 1024;
+
+  std::pmr::monotonic_buffer_resource resource{INITIAL_BLOCK_SIZE};
+  std::vector<Destructor> destructors = {};
+
+  Arena() = default;
+  Arena(const Arena&) = delete;
+  Arena(Arena&&) = delete;
+  auto operator=(const Arena&) -> Arena& = delete;
+  auto operator=(Arena&&) -> Arena& = delete;
+
+  ~Arena() {
+    for (auto it = destructors.rbegin(); it != destructors.rend(); ++it) {
+      it->destroy(it->object);
+    }
+  }
+
+  template<typename T, typename... Args>
+  auto make(Args&&... args) -> T* {
+    auto* memory = resource.allocate(sizeof(T), alignof(T));
+    auto* object = new (memory) T{std::forward<Args>(args)...};
+
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      if constexpr (requires { object->needsDestruction(); }) {
+        if (!object->needsDestruction()) return object;
+      }
+      destructors.push_back(Destructor{object, [](void* ptr) { static_cast<T*>(ptr)->~T(); }});
+    }
+
+    return object;
+  }
+
+  // Moves `values` into the arena, for a node's child list. The elements must
+  // not need destroying, so the list is released with the blocks.
+  template<typename T>
+  auto list(std::vector<T>&& values) -> std::span<T> {
+    static_assert(std::is_trivially_destructible_v<T>);
+    if (values.empty()) return {};
+
+    auto* memory = static_cast<T*>(resource.allocate(sizeof(T) * values.size(), alignof(T)));
+    std::uninitialized_move(values.begin(), values.end(), memory);
+    return {memory, values.size()};
+  }
+};
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Arena.hpp"
 #include "Object.hpp"
 #include "TokenType.hpp"
 
@@ -7,10 +8,23 @@
 #include <fmt/format.h>
 #include <fmt/ranges.h>
 
+#include <cstddef>
 #include <memory>
+#include <optional>
+#include <span>
+#include <type_traits>
 #include <variant>
+#include <vector>
 
 namespace lox {
+// Lexical address of a local variable, filled in by the Resolver: how many
+// environments to walk up, and the index into that environment's slots.
+// Unresolved names are globals and are looked up by Symbol.
+struct Binding {
+  std::size_t depth = {};
+  std::size_t slot = {};
+};
+
 struct Assign;
 struct Binary;
 struct Call;
@@ -21,19 +35,20 @@ struct Unary;
 struct Variable;
 using Expr = std::variant<
   std::monostate,
-  std::unique_ptr<Assign>,
-  std::unique_ptr<Binary>,
-  std::unique_ptr<Call>,
-  std::unique_ptr<Grouping>,
-  std::unique_ptr<Literal>,
-  std::unique_ptr<Logical>,
-  std::unique_ptr<Unary>,
-  std::unique_ptr<Variable>
+  Assign*,
+  Binary*,
+  Call*,
+  Grouping*,
+  Literal*,
+  Logical*,
+  Unary*,
+  Variable*
 >;
 
 struct Assign {
   Token name;
   Expr value;
+  std::optional<Binding> binding = {};
 };
 
 struct Binary {
@@ -45,7 +60,7 @@ struct Binary {
 struct Call {
   Expr callee;
   Token paren;
-  std::vector<Expr> arguments;
+  std::span<Expr> arguments;
 };
 
 struct Grouping {
@@ -54,6 +69,11 @@ struct Grouping {
 
 struct Literal {
   Object value;
+
+  // Only a string owns anything; the Arena skips destroying the rest.
+  auto needsDestruction() const -> bool {
+    return isString(value);
+  }
 };
 
 struct Logical {
@@ -69,6 +89,7 @@ struct Unary {
 
 struct Variable {
   Token name;
+  std::optional<Binding> binding = {};
 };
 
 struct Block;
@@ -81,18 +102,18 @@ struct Var;
 struct While;
 using Stmt = std::variant<
   std::monostate,
-  std::unique_ptr<Block>,
-  std::unique_ptr<Expression>,
-  std::unique_ptr<Function>,
-  std::unique_ptr<IfStmt>,
-  std::unique_ptr<Print>,
-  std::unique_ptr<Return>,
-  std::unique_ptr<Var>,
-  std::unique_ptr<While>
+  Block*,
+  Expression*,
+  Function*,
+  IfStmt*,
+  Print*,
+  Return*,
+  Var*,
+  While*
 >;
 
 struct Block {
-  std::vector<Stmt> statements;
+  std::span<Stmt> statements;
 };
 
 struct Expression {
@@ -101,8 +122,9 @@ struct Expression {
 
 struct Function {
   Token name;
-  std::vector<Token> params;
-  std::vector<Stmt> body;
+  std::span<Token> params;
+  std::span<Stmt> body;
+  std::optional<std::size_t> slot = {};
 };
 
 struct IfStmt {
@@ -123,12 +145,37 @@ struct Return {
 struct Var {
   Token name;
   Expr initializer;
+  std::optional<std::size_t> slot = {};
 };
 
 struct While {
+  // Empty when the Optimizer proved the condition always true.
   Expr condition;
   Stmt body;
 };
+
+// Every node but Literal is released with the Arena's blocks and never
+// destroyed on its own.
+static_assert(
+  std::is_trivially_destructible_v<Assign> && std::is_trivially_destructible_v<Binary>
+  && std::is_trivially_destructible_v<Call> && std::is_trivially_destructible_v<Grouping>
+  && std::is_trivially_destructible_v<Logical> && std::is_trivially_destructible_v<Unary>
+  && std::is_trivially_destructible_v<Variable> && std::is_trivially_destructible_v<Block>
+  && std::is_trivially_destructible_v<Expression> && std::is_trivially_destructible_v<Function>
+  && std::is_trivially_destructible_v<IfStmt> && std::is_trivially_destructible_v<Print>
+  && std::is_trivially_destructible_v<Return> && std::is_trivially_destructible_v<Var>
+  && std::is_trivially_destructible_v<While>
+);
+
+// A parsed program. Every node reachable from `statements` is allocated in
+// `arena` and lives exactly as long as it.
+struct SyntaxTree {
+  std::unique_ptr<Arena> arena = {};
+  std::vector<Stmt> statements = {};
+  // Set when a Function node was built, since runtime function objects keep
+  // pointers to their declaration.
+  bool declaresFunctions = {};
+};
 }
 
 namespace fmt {
@@ -147,14 +194,14 @@ struct formatter<lox::Expr> {
 
     return format_to(ctx.out(), "{}", visit(overload_linearly(
       [](std::monostate) { return "nil"s; },
-      [](const unique_ptr<Assign>& expr) { return fmt::format("(assign {} {})", expr->name, expr->value); },
-      [](const unique_ptr<Binary>& expr) { return fmt::format("({} {} {})", expr->op.lexeme, expr->left, expr->right); },
-      [](const unique_ptr<Call>& expr) { return fmt::format("(call {} {} {})", expr->callee, expr->paren.lexeme, expr->arguments); },
-      [](const unique_ptr<Grouping>& expr) { return fmt::format("(group {})", expr->expression); },
-      [](const unique_ptr<Literal>& expr) { return fmt::format("{}", expr->value); },
-      [](const unique_ptr<Logical>& expr) { return fmt::format("({} {} {})", expr->left, expr->op, expr->right); },
-      [](const unique_ptr<Unary>& expr) { return fmt::format("({} {})", expr->op.lexeme, expr->right); },
-      [](const unique_ptr<Variable>& expr) { return fmt::format("(var {})", expr->name); }
+      [](Assign* expr) { return fmt::format("(assign {} {})", expr->name, expr->value); },
+      [](Binary* expr) { return fmt::format("({} {} {})", expr->op.lexeme, expr->left, expr->right); },
+      [](Call* expr) { return fmt::format("(call {} {} {})", expr->callee, expr->paren.lexeme, expr->arguments); },
+      [](Grouping* expr) { return fmt::format("(group {})", expr->expression); },
+      [](Literal* expr) { return fmt::format("{}", expr->value); },
+      [](Logical* expr) { return fmt::format("({} {} {})", expr->left, expr->op, expr->right); },
+      [](Unary* expr) { return fmt::format("({} {})", expr->op.lexeme, expr->right); },
+      [](Variable* expr) { return fmt::format("(var {})", expr->name); }
     ), expression));
   }
 };
@@ -174,12 +221,12 @@ struct formatter<lox::Stmt> {
 
     return format_to(ctx.out(), "{}", visit(overload_linearly(
       [](std::monostate) { return "nil"s; },
-      [](const unique_ptr<Block>& stmt) { return fmt::format("(eval {})", stmt->statements); },
-      [](const unique_ptr<Expression>& stmt) { return fmt::format("(eval {})", stmt->expression); },
-      [](const unique_ptr<IfStmt>& stmt) { return fmt::format("(if ({}) else ({}))", stmt->condition, stmt->thenBranch, stmt->elseBranch); },
-      [](const unique_ptr<Print>& stmt) { return fmt::format("(print {})", stmt->expression); },
-      [](const unique_ptr<Var>& stmt) { return fmt::format("(declare {} {})", stmt->name, stmt->initializer); },
-      [](const unique_ptr<While>& stmt) { return fmt::format("(while ({}) ({}))", stmt->condition, stmt->body); }
+      [](Block* stmt) { return fmt::format("(eval {})", stmt->statements); },
+      [](Expression* stmt) { return fmt::format("(eval {})", stmt->expression); },
+      [](IfStmt* stmt) { return fmt::format("(if ({}) else ({}))", stmt->condition, stmt->thenBranch, stmt->elseBranch); },
+      [](Print* stmt) { return fmt::format("(print {})", stmt->expression); },
+      [](Var* stmt) { return fmt::format("(declare {} {})", stmt->name, stmt->initializer); },
+      [](While* stmt) { return fmt::format("(while ({}) ({}))", stmt->condition, stmt->body); }
     ), statement));
   }
 };
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "Lox.hpp"
+#include "Session.hpp"
+#include "SourceFile.hpp"
+#include "ThreadPool.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace lox {
+// Many independent scripts run in one process for --batch. Each runs in a
+// Session of its own on a ThreadPool worker with its output (errors
+// included, as the command line interleaves them) captured separately and
+// printed in input order once everything has finished.
+struct Batch {
+  using Clock = std::chrono::steady_clock;
+
+  struct Script {
+    std::string path;
+    std::string output = {};
+    // Unset when the file could not be read.
+    std::optional<Session::Result> result = {};
+    Clock::duration elapsed = {};
+  };
+
+  std::vector<Script> scripts = {};
+  Clock::duration elapsed = {};
+  std::size_t workers = {};
+
+  // The scripts to run: every .lox file below `path` when it is a
+  // directory, otherwise one path per non-empty line of the file.
+  static auto open(const std::string& path) -> std::optional<Batch> {
+    namespace fs = std::filesystem;
+    using namespace std;
+
+    auto&& batch = Batch{};
+    auto&& failure = error_code{};
+    if (fs::is_directory(path, failure)) {
+      auto&& paths = vector<string>{};
+      for (auto&& entry: fs::recursive_directory_iterator{path, failure}) {
+        if (entry.is_regular_file() && entry.path().extension() == ".lox") paths.push_back(entry.path().string());
+      }
+      if (failure) return {};
+
+      ranges::sort(paths);
+      for (auto&& script: paths) batch.scripts.push_back(Script{std::move(script)});
+      return batch;
+    }
+
+    auto&& list = ifstream{path};
+    if (!list) return {};
+
+    for (auto&& line = string{}; getline(list, line);) {
+      if (!line.empty()) batch.scripts.push_back(Script{std::move(line)});
+    }
+    return batch;
+  }
+
+  auto run(const Options& options, const ThreadPool& pool) -> void {
+    auto&& start = Clock::now();
+    pool.run(scripts.size(), [&](std::size_t i) {
+      auto&& script = scripts[i];
+      auto&& begin = Clock::now();
+
+      if (auto&& source = SourceFile::open(script.path.c_str())) {
+        auto&& capture = [&script](std::string_view text) { script.output += text; };
+        script.result = Session{options, capture, capture}.run(source->view(), Session::Lifetime::SESSION);
+      }
+
+      script.elapsed = Clock::now() - begin;
+    });
+    elapsed = Clock::now() - start;
+    workers = std::min(pool.workers, scripts.size());
+  }
+
+  // Every script's output under a header naming it, in input order.
+  auto print() const -> void {
+    for (auto&& script: scripts) {
+      fmt::print("==> {} <==\n", script.path);
+      if (!script.result) fmt::print("Could not read script.\n");
+      std::fwrite(script.output.data(), 1, script.output.size(), stdout);
+      if (!script.output.empty() && script.output.back() != '\n') fmt::print("\n");
+    }
+  }
+
+  // Outcome counts, throughput and per-script latency, on stderr.
+  auto report() const -> void {
+    using enum Session::Result;
+    using namespace std::chrono;
+
+    auto&& ms = [](Clock::duration time) { return duration<double, std::milli>(time).count(); };
+
+    auto&& count = [&](std::optional<Session::Result> result) {
+      return std::ranges::count_if(scripts, [&](auto&& script) { return script.result == result; });
+    };
+
+    auto&& latencies = std::vector<Clock::duration>{};
+    for (auto&& script: scripts) latencies.push_back(script.elapsed);
+    std::ranges::sort(latencies);
+    auto&& percentile = [&](std::size_t percent) {
+      if (latencies.empty()) return 0.0;
+      return ms(latencies[std::min(latencies.size() - 1, latencies.size() * percent / 100)]);
+    };
+
+    auto&& seconds = duration<double>(elapsed).count();
+
+    fmt::print(stderr, "-- batch --\n");
+    fmt::print(stderr, "scripts   {} ({} ok, {} static errors, {} runtime errors, {} unreadable)\n",
+      scripts.size(), count(OK), count(STATIC_ERROR), count(RUNTIME_ERROR), count(std::nullopt));
+    fmt::print(stderr, "workers   {}\n", workers);
+    fmt::print(stderr, "wall      {:.3f} ms ({:.1f} scripts/s)\n",
+      ms(elapsed), seconds > 0 ? static_cast<double>(scripts.size()) / seconds : 0.0);
+    fmt::print(stderr, "latency   p50 {:.3f} ms, p90 {:.3f} ms, p99 {:.3f} ms, max {:.3f} ms\n",
+      percentile(50), percentile(90), percentile(99), percentile(100));
+  }
+
+  // The exit status runFile would use for the worst script: 65 for a
+  // static error, 70 for a runtime error, 66 (EX_NOINPUT) when a script
+  // could not be read.
+  auto status() const -> int {
+    using enum Session::Result;
+
+    auto&& any = [&](std::optional<Session::Result> result) {
+      return std::ranges::any_of(scripts, [&](auto&& script) { return script.result == result; });
+    };
+
+    if (any(STATIC_ERROR)) return 65;
+    if (any(RUNTIME_ERROR)) return 70;
+    if (any(std::nullopt)) return 66;
+    return 0;
+  }
+};
+}
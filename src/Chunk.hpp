@@ -0,0 +1,144 @@
+#pragma once
+
+#include "LoxCallable.hpp"
+#include "Object.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace lox {
+enum class OpCode: std::uint8_t {
+  CONSTANT,       // u16 constant index
+  NIL,
+  TRUE,
+  FALSE,
+  POP,
+  GET_LOCAL,      // u8 stack slot
+  SET_LOCAL,      // u8 stack slot
+  GET_GLOBAL,     // u16 global index
+  DEFINE_GLOBAL,  // u16 global index
+  SET_GLOBAL,     // u16 global index
+  GET_UPVALUE,    // u8 upvalue index
+  SET_UPVALUE,    // u8 upvalue index
+  EQUAL,
+  NOT_EQUAL,
+  GREATER,
+  GREATER_EQUAL,
+  LESS,
+  LESS_EQUAL,
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  NOT,
+  NEGATE,
+  PRINT,
+  JUMP,           // u16 forward offset
+  JUMP_IF_FALSE,  // u16 forward offset
+  LOOP,           // u16 backward offset
+  CALL,           // u8 argument count
+  CLOSURE,        // u16 function index, then (u8 isLocal, u8 index) per upvalue
+  CLOSE_UPVALUE,
+  RETURN,
+};
+
+struct JitCode;
+struct VmFunction;
+
+// A compiled unit of bytecode. Line numbers are stored run-length encoded:
+// one entry per run of consecutive bytes that came from the same source line.
+struct Chunk {
+  struct LineStart {
+    std::size_t offset = {};
+    std::size_t line = {};
+  };
+
+  std::vector<std::uint8_t> code = {};
+  std::vector<Object> constants = {};
+  std::vector<std::shared_ptr<VmFunction>> functions = {};
+  std::vector<LineStart> lines = {};
+
+  auto write(std::uint8_t byte, std::size_t line) -> void {
+    if (lines.empty() || lines.back().line != line) {
+      lines.push_back(LineStart{code.size(), line});
+    }
+
+    code.push_back(byte);
+  }
+
+  auto write(OpCode op, std::size_t line) -> void {
+    write(static_cast<std::uint8_t>(op), line);
+  }
+
+  auto addConstant(Object value) -> std::size_t {
+    constants.push_back(std::move(value));
+    return constants.size() - 1;
+  }
+
+  auto addFunction(std::shared_ptr<VmFunction> function) -> std::size_t {
+    functions.push_back(std::move(function));
+    return functions.size() - 1;
+  }
+
+  auto getLine(std::size_t offset) const -> std::size_t {
+    auto&& line = std::size_t{};
+    for (auto&& start: lines) {
+      if (start.offset > offset) break;
+      line = start.line;
+    }
+
+    return line;
+  }
+};
+
+struct VmFunction {
+  // Stack slots, counted from a frame's first, that the Vm makes room for
+  // on every call. Deeper expressions only fail if the stack is full.
+  static constexpr std::size_t FRAME_SLOTS = 256;
+
+  std::string name = {};
+  std::size_t arity = {};
+  std::size_t upvalueCount = {};
+  Chunk chunk = {};
+  // Calls and loop iterations so far, until the Jit compiles it.
+  std::uint32_t hotness = {};
+  std::shared_ptr<JitCode> jit = {};
+};
+
+// A captured variable. While the enclosing frame is live it points into the
+// VM stack; once that slot goes out of scope the value moves into `closed`.
+struct Upvalue {
+  Object* location = {};
+  Object closed = {};
+};
+
+struct VmClosure: public LoxCallable {
+  std::shared_ptr<VmFunction> function;
+  std::vector<std::shared_ptr<Upvalue>> upvalues;
+
+  explicit VmClosure(std::shared_ptr<VmFunction> function):
+    function(std::move(function))
+  {
+    upvalues.resize(this->function->upvalueCount);
+  }
+
+  ~VmClosure() override = default;
+
+  auto arity() -> std::size_t override {
+    return function->arity;
+  }
+
+  auto call(Interpreter&, std::span<Object>) -> Object override {
+    throw std::logic_error{"Bytecode closures can only be called by the Vm."};
+  }
+
+  auto name() const -> std::string override {
+    return function->name;
+  }
+};
+}
@@ -0,0 +1,423 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "Environment.hpp"
+#include "Interpreter.hpp"
+#include "LoxFunction.hpp"
+#include "Object.hpp"
+#include "TokenType.hpp"
+
+#include <boost/hana/functional/overload_linearly.hpp>
+#include <fmt/format.h>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace lox {
+// Engine::CLOSURE. Walks a resolved syntax tree once and turns every node
+// into a C++ closure already specialized for it: which operator, whether an
+// operand is a constant number, how far up a local lives. Running a node is
+// then one indirect call instead of a variant visit plus an operator switch.
+//
+// The closures run on an Interpreter, using its environments, calls, error
+// handling and Heap exactly as the tree walker does, so the two engines
+// behave the same. Statement and expression counters are not kept.
+struct ClosureCompiler {
+  using Evaluate = std::function<auto (Interpreter&) -> Object>;
+  using Execute = std::function<auto (Interpreter&) -> Completion>;
+  using Body = std::vector<Execute>;
+
+  // A function declared by compiled code; its body was compiled with it.
+  struct CompiledFunction final: public LoxFunction {
+    std::shared_ptr<const Body> body;
+
+    CompiledFunction(Function* declaration, std::shared_ptr<const Body> body, std::shared_ptr<Environment> closure):
+      LoxFunction(declaration, std::move(closure)),
+      body(std::move(body))
+    {}
+
+    ~CompiledFunction() override = default;
+
+    auto call(Interpreter& interpreter, std::span<Object> arguments) -> Object override {
+      auto&& environment = interpreter.acquire(closure);
+      for (std::size_t i = 0; i < arguments.size(); i++) {
+        environment->defineAt(i, std::move(arguments[i]));
+      }
+
+      if (interpreter.profiler) interpreter.profiler->enter(declaration->name.lexeme);
+      auto&& completion = run(interpreter, *body, environment);
+      if (interpreter.profiler) interpreter.profiler->leave();
+      interpreter.release(std::move(environment));
+
+      if (completion == Completion::RETURN) {
+        return std::exchange(interpreter.returnValue, Object{});
+      }
+      return {};
+    }
+  };
+
+  static auto compile(std::span<const Stmt> statements) -> Body {
+    auto&& body = Body{};
+    body.reserve(statements.size());
+    for (auto&& statement: statements) body.push_back(compile(statement));
+    return body;
+  }
+
+  // Runs a compiled program like Interpreter::interpret.
+  static auto interpret(Interpreter& interpreter, const Body& program) -> void {
+    for (auto&& statement: program) {
+      if (statement(interpreter) == Completion::ERROR) {
+        interpreter.diagnostics.runtimeError(*interpreter.error);
+        interpreter.error.reset();
+        return;
+      }
+    }
+  }
+
+  // Interpreter::executeBlock for compiled statements.
+  static auto run(Interpreter& interpreter, const Body& body, const std::shared_ptr<Environment>& next) -> Completion {
+    using enum Completion;
+
+    auto previous = std::exchange(interpreter.environment, next);
+    interpreter.counters.enter();
+
+    auto&& completion = NORMAL;
+    for (auto&& statement: body) {
+      completion = statement(interpreter);
+      if (completion != NORMAL) break;
+    }
+
+    interpreter.environment = std::move(previous);
+    interpreter.counters.leave();
+    return completion;
+  }
+
+  static auto trace(Interpreter& interpreter, const Stmt& statement) -> void {
+    if (interpreter.profiler) interpreter.profiler->at(statement);
+  }
+
+  static auto compile(const Stmt& statement) -> Execute {
+    using enum Completion;
+    using namespace boost::hana;
+    using namespace std;
+
+    return visit(overload_linearly(
+      [](std::monostate) -> Execute { return [](Interpreter&) { return NORMAL; }; },
+      [statement](Block* stmt) -> Execute {
+        return [statement, body = compile(stmt->statements)](Interpreter& interpreter) {
+          trace(interpreter, statement);
+          auto&& block = interpreter.acquire(interpreter.environment);
+          auto&& completion = run(interpreter, body, block);
+          interpreter.release(std::move(block));
+          return completion;
+        };
+      },
+      [statement](Expression* stmt) -> Execute {
+        return [statement, expression = compile(stmt->expression)](Interpreter& interpreter) {
+          trace(interpreter, statement);
+          expression(interpreter);
+          return interpreter.error ? ERROR : NORMAL;
+        };
+      },
+      [statement](Function* stmt) -> Execute {
+        auto&& body = make_shared<const Body>(compile(stmt->body));
+        return [statement, stmt, body = std::move(body)](Interpreter& interpreter) {
+          trace(interpreter, statement);
+          interpreter.heap.track(interpreter.environment);
+          auto&& function = Ref<LoxCallable>{Ref<CompiledFunction>::make(stmt, body, interpreter.environment)};
+          interpreter.define(stmt->name, stmt->slot, std::move(function));
+          return NORMAL;
+        };
+      },
+      [statement](IfStmt* stmt) -> Execute {
+        auto&& condition = compile(stmt->condition);
+        auto&& thenBranch = compile(stmt->thenBranch);
+        if (holds_alternative<std::monostate>(stmt->elseBranch)) {
+          return [statement, condition = std::move(condition), thenBranch = std::move(thenBranch)](Interpreter& interpreter) {
+            trace(interpreter, statement);
+            auto&& truthy = isTruthy(condition(interpreter));
+            if (interpreter.error) return ERROR;
+            return truthy ? thenBranch(interpreter) : NORMAL;
+          };
+        }
+
+        return [statement, condition = std::move(condition), thenBranch = std::move(thenBranch), elseBranch = compile(stmt->elseBranch)](Interpreter& interpreter) {
+          trace(interpreter, statement);
+          auto&& truthy = isTruthy(condition(interpreter));
+          if (interpreter.error) return ERROR;
+          return truthy ? thenBranch(interpreter) : elseBranch(interpreter);
+        };
+      },
+      [statement](Print* stmt) -> Execute {
+        return [statement, expression = compile(stmt->expression)](Interpreter& interpreter) {
+          trace(interpreter, statement);
+          auto&& value = expression(interpreter);
+          if (interpreter.error) return ERROR;
+
+          emit(interpreter.output, "{}\n", value);
+          return NORMAL;
+        };
+      },
+      [statement](Return* stmt) -> Execute {
+        return [statement, value = compile(stmt->value)](Interpreter& interpreter) {
+          trace(interpreter, statement);
+          interpreter.returnValue = value(interpreter);
+          return interpreter.error ? ERROR : RETURN;
+        };
+      },
+      [statement](Var* stmt) -> Execute {
+        return [statement, stmt, initializer = compile(stmt->initializer)](Interpreter& interpreter) {
+          trace(interpreter, statement);
+          auto&& value = initializer(interpreter);
+          if (interpreter.error) return ERROR;
+
+          interpreter.define(stmt->name, stmt->slot, std::move(value));
+          return NORMAL;
+        };
+      },
+      [statement](While* stmt) -> Execute {
+        auto&& body = compile(stmt->body);
+        if (holds_alternative<std::monostate>(stmt->condition)) {
+          return [statement, body = std::move(body)](Interpreter& interpreter) {
+            trace(interpreter, statement);
+            for (;;) {
+              if (auto&& completion = body(interpreter); completion != NORMAL) return completion;
+            }
+          };
+        }
+
+        return [statement, condition = compile(stmt->condition), body = std::move(body)](Interpreter& interpreter) {
+          trace(interpreter, statement);
+          for (;;) {
+            auto&& truthy = isTruthy(condition(interpreter));
+            if (interpreter.error) return ERROR;
+            if (!truthy) return NORMAL;
+
+            if (auto&& completion = body(interpreter); completion != NORMAL) return completion;
+          }
+        };
+      }
+    ), statement);
+  }
+
+  // The value of a number literal, looking through parentheses.
+  static auto constantNumber(const Expr& expression) -> std::optional<double> {
+    if (auto* grouping = std::get_if<Grouping*>(&expression)) return constantNumber((*grouping)->expression);
+    if (auto* literal = std::get_if<Literal*>(&expression); literal && isNumber((*literal)->value)) {
+      return asNumber((*literal)->value);
+    }
+    return {};
+  }
+
+  // A binary operator on numbers. A constant right operand is folded into
+  // the closure, which skips evaluating it and checking its type.
+  template<typename Op>
+  static auto numeric(Binary* expr, Evaluate left, const Expr& rightExpression) -> Evaluate {
+    if (auto&& constant = constantNumber(rightExpression)) {
+      return [expr, left = std::move(left), right = *constant](Interpreter& interpreter) -> Object {
+        auto&& a = left(interpreter);
+        if (interpreter.error) return {};
+        if (!isNumber(a)) return interpreter.fail(expr->op, "Operands must be numbers.");
+        return Op{}(asNumber(a), right);
+      };
+    }
+
+    return [expr, left = std::move(left), right = compile(rightExpression)](Interpreter& interpreter) -> Object {
+      auto&& a = left(interpreter);
+      if (interpreter.error) return {};
+      auto&& b = right(interpreter);
+      if (interpreter.error) return {};
+      if (!interpreter.checkNumberOperands(expr->op, a, b)) return {};
+      return Op{}(asNumber(a), asNumber(b));
+    };
+  }
+
+  static auto add(Binary* expr, Evaluate left, const Expr& rightExpression) -> Evaluate {
+    if (auto&& constant = constantNumber(rightExpression)) {
+      return [expr, left = std::move(left), right = *constant](Interpreter& interpreter) -> Object {
+        auto&& a = left(interpreter);
+        if (interpreter.error) return {};
+        if (!isNumber(a)) return interpreter.fail(expr->op, "Operands must be two numbers or two strings");
+        return asNumber(a) + right;
+      };
+    }
+
+    return [expr, left = std::move(left), right = compile(rightExpression)](Interpreter& interpreter) -> Object {
+      auto&& a = left(interpreter);
+      if (interpreter.error) return {};
+      auto&& b = right(interpreter);
+      if (interpreter.error) return {};
+
+      if (isNumber(a) && isNumber(b)) return asNumber(a) + asNumber(b);
+      if (isString(a) && isString(b)) return LoxString::concat(asLoxString(a), asLoxString(b));
+      return interpreter.fail(expr->op, "Operands must be two numbers or two strings");
+    };
+  }
+
+  template<bool equal>
+  static auto equality(Evaluate left, Evaluate right) -> Evaluate {
+    return [left = std::move(left), right = std::move(right)](Interpreter& interpreter) -> Object {
+      auto&& a = left(interpreter);
+      if (interpreter.error) return {};
+      auto&& b = right(interpreter);
+      if (interpreter.error) return {};
+      return isEqual(a, b) == equal;
+    };
+  }
+
+  static auto compile(const Expr& expression) -> Evaluate {
+    using enum TokenType;
+    using namespace boost::hana;
+    using namespace fmt;
+    using namespace std;
+
+    return visit(overload_linearly(
+      [](std::monostate) -> Evaluate { return [](Interpreter&) -> Object { return std::monostate{}; }; },
+      [](Assign* expr) -> Evaluate {
+        auto&& value = compile(expr->value);
+        if (!expr->binding) {
+          return [expr, value = std::move(value)](Interpreter& interpreter) -> Object {
+            auto&& result = value(interpreter);
+            if (interpreter.error) return {};
+
+            auto&& global = interpreter.globals->find(expr->name.symbol);
+            if (!global) return interpreter.fail(expr->name, format("Undefined variable {}.", expr->name.lexeme));
+            *global = result;
+            return result;
+          };
+        }
+
+        auto&& binding = *expr->binding;
+        if (binding.depth == 0) {
+          return [slot = binding.slot, value = std::move(value)](Interpreter& interpreter) -> Object {
+            auto&& result = value(interpreter);
+            if (interpreter.error) return {};
+            interpreter.environment->slots[slot] = result;
+            return result;
+          };
+        }
+
+        return [binding, value = std::move(value)](Interpreter& interpreter) -> Object {
+          auto&& result = value(interpreter);
+          if (interpreter.error) return {};
+          interpreter.environment->assignAt(binding.depth, binding.slot, result);
+          return result;
+        };
+      },
+      [](Binary* expr) -> Evaluate {
+        auto&& left = compile(expr->left);
+        switch (expr->op.type) {
+          case GREATER: return numeric<std::greater<>>(expr, std::move(left), expr->right);
+          case GREATER_EQUAL: return numeric<std::greater_equal<>>(expr, std::move(left), expr->right);
+          case LESS: return numeric<std::less<>>(expr, std::move(left), expr->right);
+          case LESS_EQUAL: return numeric<std::less_equal<>>(expr, std::move(left), expr->right);
+          case MINUS: return numeric<std::minus<>>(expr, std::move(left), expr->right);
+          case SLASH: return numeric<std::divides<>>(expr, std::move(left), expr->right);
+          case STAR: return numeric<std::multiplies<>>(expr, std::move(left), expr->right);
+          case PLUS: return add(expr, std::move(left), expr->right);
+          case BANG_EQUAL: return equality<false>(std::move(left), compile(expr->right));
+          case EQUAL_EQUAL: return equality<true>(std::move(left), compile(expr->right));
+          default: break;
+        }
+
+        return [left = std::move(left), right = compile(expr->right)](Interpreter& interpreter) -> Object {
+          left(interpreter);
+          if (interpreter.error) return {};
+          right(interpreter);
+          return std::monostate{};
+        };
+      },
+      [](Call* expr) -> Evaluate {
+        auto&& arguments = vector<Evaluate>{};
+        for (auto&& argument: expr->arguments) arguments.push_back(compile(argument));
+
+        return [expr, callee = compile(expr->callee), arguments = std::move(arguments)](Interpreter& interpreter) -> Object {
+          auto&& function = callee(interpreter);
+          if (interpreter.error) return {};
+
+          auto&& stack = interpreter.arguments;
+          auto&& base = stack.size();
+          for (auto&& argument: arguments) {
+            stack.push_back(argument(interpreter));
+            if (interpreter.error) break;
+          }
+
+          auto&& result = interpreter.error ? Object{} : interpreter.call(*expr, function, span{stack}.subspan(base));
+          stack.resize(base);
+          return result;
+        };
+      },
+      [](Grouping* expr) -> Evaluate { return compile(expr->expression); },
+      [](Literal* expr) -> Evaluate {
+        return [value = expr->value](Interpreter&) -> Object { return value; };
+      },
+      [](Logical* expr) -> Evaluate {
+        if (expr->op.type == OR) {
+          return [left = compile(expr->left), right = compile(expr->right)](Interpreter& interpreter) -> Object {
+            auto&& value = left(interpreter);
+            if (interpreter.error) return {};
+            if (isTruthy(value)) return value;
+            return right(interpreter);
+          };
+        }
+
+        return [left = compile(expr->left), right = compile(expr->right)](Interpreter& interpreter) -> Object {
+          auto&& value = left(interpreter);
+          if (interpreter.error) return {};
+          if (!isTruthy(value)) return value;
+          return right(interpreter);
+        };
+      },
+      [](Unary* expr) -> Evaluate {
+        auto&& right = compile(expr->right);
+        switch (expr->op.type) {
+          case BANG:
+            return [right = std::move(right)](Interpreter& interpreter) -> Object {
+              auto&& value = right(interpreter);
+              if (interpreter.error) return {};
+              return !isTruthy(value);
+            };
+          case MINUS:
+            return [expr, right = std::move(right)](Interpreter& interpreter) -> Object {
+              auto&& value = right(interpreter);
+              if (interpreter.error) return {};
+              if (!interpreter.checkNumberOperand(expr->op, value)) return {};
+              return -asNumber(value);
+            };
+          default:
+            break;
+        }
+
+        return [right = std::move(right)](Interpreter& interpreter) -> Object {
+          right(interpreter);
+          return std::monostate{};
+        };
+      },
+      [](Variable* expr) -> Evaluate {
+        if (!expr->binding) {
+          return [expr](Interpreter& interpreter) -> Object {
+            if (auto&& global = interpreter.globals->find(expr->name.symbol)) return **global;
+            return interpreter.fail(expr->name, format("Undefined variable '{}'.", expr->name.lexeme));
+          };
+        }
+
+        auto&& binding = *expr->binding;
+        switch (binding.depth) {
+          case 0:
+            return [slot = binding.slot](Interpreter& interpreter) -> Object { return interpreter.environment->slots[slot]; };
+          case 1:
+            return [slot = binding.slot](Interpreter& interpreter) -> Object { return interpreter.environment->enclosing->slots[slot]; };
+          default:
+            return [binding](Interpreter& interpreter) -> Object { return interpreter.environment->getAt(binding.depth, binding.slot); };
+        }
+      }
+    ), expression);
+  }
+};
+}
@@ -0,0 +1,452 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "Chunk.hpp"
+#include "Diagnostics.hpp"
+#include "Object.hpp"
+#include "Symbol.hpp"
+#include "TokenType.hpp"
+
+#include <boost/hana/functional/overload_linearly.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace lox {
+// Output of the Compiler: the top-level script function plus the names of the
+// globals it introduced. Globals are addressed by index at runtime and indices
+// keep counting across programs from the same Compiler, so a Vm can run them
+// one after another; the names are only kept for error messages.
+struct Program {
+  std::shared_ptr<VmFunction> script = {};
+  std::vector<std::string> globals = {};
+};
+
+// Lowers the resolved AST into bytecode for the Vm. Locals live on the VM
+// stack and are tracked here the same way the Resolver tracks scopes.
+struct Compiler {
+  struct CompileError{};
+
+  struct Local {
+    Symbol name = NO_SYMBOL;
+    std::size_t depth = {};
+    bool isCaptured = {};
+  };
+
+  struct UpvalueRef {
+    std::uint8_t index = {};
+    bool isLocal = {};
+  };
+
+  struct FunctionState {
+    FunctionState* enclosing = {};
+    std::shared_ptr<VmFunction> function = {};
+    std::vector<Local> locals = {};
+    std::vector<UpvalueRef> upvalues = {};
+    std::size_t scopeDepth = {};
+  };
+
+  Diagnostics& diagnostics;
+  FunctionState* current = {};
+  std::unordered_map<Symbol, std::uint16_t> globalIndices = {};
+  std::vector<std::string> globals = {};
+  // Globals already handed out in an earlier Program.
+  std::size_t reportedGlobals = {};
+  std::size_t line = {1};
+
+  auto compile(std::span<const Stmt> statements) -> Program {
+    using namespace std;
+
+    auto&& state = FunctionState{};
+    state.function = make_shared<VmFunction>();
+    state.function->name = "script";
+    beginFunction(state);
+
+    try {
+      for (auto&& statement: statements) {
+        compile(statement);
+      }
+    } catch (const CompileError&) {
+      // The Compiler outlives a failed program when a Session keeps it.
+      current = nullptr;
+      return {};
+    }
+
+    emitReturn();
+    current = state.enclosing;
+
+    auto&& introduced = vector<string>{globals.begin() + static_cast<ptrdiff_t>(reportedGlobals), globals.end()};
+    reportedGlobals = globals.size();
+    return Program{state.function, std::move(introduced)};
+  }
+
+  auto compile(const Stmt& statement) -> void {
+    using enum OpCode;
+    using namespace boost::hana;
+    using namespace std;
+
+    visit(overload_linearly(
+      [](std::monostate) {},
+      [this](Block* stmt) {
+        beginScope();
+        for (auto&& inner: stmt->statements) {
+          compile(inner);
+        }
+        endScope();
+      },
+      [this](Expression* stmt) {
+        compile(stmt->expression);
+        emit(POP);
+      },
+      [this](Function* stmt) {
+        line = stmt->name.line;
+        if (current->scopeDepth > 0) {
+          // Mark initialized before compiling the body so it can recurse.
+          addLocal(stmt->name);
+          function(*stmt);
+        } else {
+          function(*stmt);
+          emitGlobal(DEFINE_GLOBAL, stmt->name);
+        }
+      },
+      [this](IfStmt* stmt) {
+        compile(stmt->condition);
+        auto&& thenJump = emitJump(JUMP_IF_FALSE);
+        emit(POP);
+        compile(stmt->thenBranch);
+
+        auto&& elseJump = emitJump(JUMP);
+        patchJump(thenJump);
+        emit(POP);
+        compile(stmt->elseBranch);
+        patchJump(elseJump);
+      },
+      [this](Print* stmt) {
+        compile(stmt->expression);
+        emit(PRINT);
+      },
+      [this](Return* stmt) {
+        line = stmt->keyword.line;
+        if (stmt->value == Expr{monostate{}}) {
+          emit(NIL);
+        } else {
+          compile(stmt->value);
+        }
+        emit(RETURN);
+      },
+      [this](Var* stmt) {
+        line = stmt->name.line;
+        if (stmt->initializer == Expr{monostate{}}) {
+          emit(NIL);
+        } else {
+          compile(stmt->initializer);
+        }
+
+        if (current->scopeDepth > 0) {
+          addLocal(stmt->name);
+        } else {
+          emitGlobal(DEFINE_GLOBAL, stmt->name);
+        }
+      },
+      [this](While* stmt) {
+        auto&& loopStart = current->function->chunk.code.size();
+        if (holds_alternative<std::monostate>(stmt->condition)) {
+          compile(stmt->body);
+          emitLoop(loopStart);
+          return;
+        }
+
+        compile(stmt->condition);
+
+        auto&& exitJump = emitJump(JUMP_IF_FALSE);
+        emit(POP);
+        compile(stmt->body);
+        emitLoop(loopStart);
+
+        patchJump(exitJump);
+        emit(POP);
+      }
+    ), statement);
+  }
+
+  auto compile(const Expr& expression) -> void {
+    using enum OpCode;
+    using namespace boost::hana;
+    using namespace std;
+
+    visit(overload_linearly(
+      [this](std::monostate) { emit(NIL); },
+      [this](Assign* expr) {
+        compile(expr->value);
+        line = expr->name.line;
+        namedVariable(expr->name, true);
+      },
+      [this](Binary* expr) {
+        compile(expr->left);
+        compile(expr->right);
+        line = expr->op.line;
+
+        switch (expr->op.type) {
+          case TokenType::BANG_EQUAL: emit(NOT_EQUAL); break;
+          case TokenType::EQUAL_EQUAL: emit(EQUAL); break;
+          case TokenType::GREATER: emit(GREATER); break;
+          case TokenType::GREATER_EQUAL: emit(GREATER_EQUAL); break;
+          case TokenType::LESS: emit(LESS); break;
+          case TokenType::LESS_EQUAL: emit(LESS_EQUAL); break;
+          case TokenType::MINUS: emit(SUBTRACT); break;
+          case TokenType::PLUS: emit(ADD); break;
+          case TokenType::SLASH: emit(DIVIDE); break;
+          case TokenType::STAR: emit(MULTIPLY); break;
+          default: break;
+        }
+      },
+      [this](Call* expr) {
+        compile(expr->callee);
+        for (auto&& argument: expr->arguments) {
+          compile(argument);
+        }
+
+        line = expr->paren.line;
+        emit(CALL);
+        emitByte(static_cast<uint8_t>(expr->arguments.size()));
+      },
+      [this](Grouping* expr) { compile(expr->expression); },
+      [this](Literal* expr) {
+        if (isNil(expr->value)) {
+          emit(NIL);
+        } else if (isBool(expr->value)) {
+          emit(asBool(expr->value) ? TRUE : FALSE);
+        } else {
+          emitConstant(expr->value);
+        }
+      },
+      [this](Logical* expr) {
+        compile(expr->left);
+        line = expr->op.line;
+
+        if (expr->op.type == TokenType::OR) {
+          auto&& elseJump = emitJump(JUMP_IF_FALSE);
+          auto&& endJump = emitJump(JUMP);
+          patchJump(elseJump);
+          emit(POP);
+          compile(expr->right);
+          patchJump(endJump);
+        } else {
+          auto&& endJump = emitJump(JUMP_IF_FALSE);
+          emit(POP);
+          compile(expr->right);
+          patchJump(endJump);
+        }
+      },
+      [this](Unary* expr) {
+        compile(expr->right);
+        line = expr->op.line;
+
+        switch (expr->op.type) {
+          case TokenType::BANG: emit(NOT); break;
+          case TokenType::MINUS: emit(NEGATE); break;
+          default: break;
+        }
+      },
+      [this](Variable* expr) {
+        line = expr->name.line;
+        namedVariable(expr->name, false);
+      }
+    ), expression);
+  }
+
+  auto function(const Function& declaration) -> void {
+    using enum OpCode;
+    using namespace std;
+
+    auto&& state = FunctionState{};
+    state.function = make_shared<VmFunction>();
+    state.function->name = std::string{declaration.name.lexeme};
+    state.function->arity = declaration.params.size();
+    beginFunction(state);
+
+    beginScope();
+    for (auto&& param: declaration.params) {
+      addLocal(param);
+    }
+    for (auto&& statement: declaration.body) {
+      compile(statement);
+    }
+    emitReturn();
+
+    current = state.enclosing;
+    state.function->upvalueCount = state.upvalues.size();
+
+    auto&& index = current->function->chunk.addFunction(state.function);
+    emit(CLOSURE);
+    emitShort(checkIndex(index, "Too many functions in one chunk."));
+    for (auto&& upvalue: state.upvalues) {
+      emitByte(upvalue.isLocal ? 1 : 0);
+      emitByte(upvalue.index);
+    }
+  }
+
+  auto namedVariable(const Token& name, bool assign) -> void {
+    using enum OpCode;
+
+    if (auto&& slot = resolveLocal(*current, name.symbol); slot >= 0) {
+      emit(assign ? SET_LOCAL : GET_LOCAL);
+      emitByte(static_cast<std::uint8_t>(slot));
+    } else if (auto&& upvalue = resolveUpvalue(*current, name.symbol); upvalue >= 0) {
+      emit(assign ? SET_UPVALUE : GET_UPVALUE);
+      emitByte(static_cast<std::uint8_t>(upvalue));
+    } else {
+      emitGlobal(assign ? SET_GLOBAL : GET_GLOBAL, name);
+    }
+  }
+
+  auto resolveLocal(const FunctionState& state, Symbol name) -> int {
+    for (auto i = state.locals.size(); i-- > 0;) {
+      if (state.locals[i].name == name) return static_cast<int>(i);
+    }
+
+    return -1;
+  }
+
+  auto resolveUpvalue(FunctionState& state, Symbol name) -> int {
+    if (!state.enclosing) return -1;
+
+    if (auto&& local = resolveLocal(*state.enclosing, name); local >= 0) {
+      state.enclosing->locals[static_cast<std::size_t>(local)].isCaptured = true;
+      return addUpvalue(state, static_cast<std::uint8_t>(local), true);
+    }
+
+    if (auto&& upvalue = resolveUpvalue(*state.enclosing, name); upvalue >= 0) {
+      return addUpvalue(state, static_cast<std::uint8_t>(upvalue), false);
+    }
+
+    return -1;
+  }
+
+  auto addUpvalue(FunctionState& state, std::uint8_t index, bool isLocal) -> int {
+    for (std::size_t i = 0; i < state.upvalues.size(); i++) {
+      if (state.upvalues[i].index == index && state.upvalues[i].isLocal == isLocal) {
+        return static_cast<int>(i);
+      }
+    }
+
+    if (state.upvalues.size() > std::numeric_limits<std::uint8_t>::max()) {
+      fail("Too many closure variables in function.");
+    }
+
+    state.upvalues.push_back(UpvalueRef{index, isLocal});
+    return static_cast<int>(state.upvalues.size() - 1);
+  }
+
+  auto addLocal(const Token& name) -> void {
+    if (current->locals.size() > std::numeric_limits<std::uint8_t>::max()) {
+      fail("Too many local variables in function.");
+    }
+
+    current->locals.push_back(Local{name.symbol, current->scopeDepth, false});
+  }
+
+  auto beginFunction(FunctionState& state) -> void {
+    state.enclosing = current;
+    current = &state;
+
+    // Slot zero holds the callee itself, as in the call frame layout.
+    current->locals.push_back(Local{NO_SYMBOL, 0, false});
+  }
+
+  auto beginScope() -> void {
+    current->scopeDepth++;
+  }
+
+  auto endScope() -> void {
+    using enum OpCode;
+
+    current->scopeDepth--;
+
+    auto&& locals = current->locals;
+    while (!locals.empty() && locals.back().depth > current->scopeDepth) {
+      emit(locals.back().isCaptured ? CLOSE_UPVALUE : POP);
+      locals.pop_back();
+    }
+  }
+
+  auto emitGlobal(OpCode op, const Token& name) -> void {
+    emit(op);
+    emitShort(globalIndex(name.symbol, name.lexeme));
+  }
+
+  // The index of the global `symbol`, allocating the next one on first use.
+  auto globalIndex(Symbol symbol, std::string_view name) -> std::uint16_t {
+    auto&& [it, inserted] = globalIndices.try_emplace(symbol, std::uint16_t{});
+    if (inserted) {
+      it->second = checkIndex(globals.size(), "Too many global variables.");
+      globals.emplace_back(name);
+    }
+    return it->second;
+  }
+
+  auto emitConstant(const Object& value) -> void {
+    auto&& index = current->function->chunk.addConstant(value);
+    emit(OpCode::CONSTANT);
+    emitShort(checkIndex(index, "Too many constants in one chunk."));
+  }
+
+  auto emitJump(OpCode op) -> std::size_t {
+    emit(op);
+    emitShort(0xffff);
+    return current->function->chunk.code.size() - 2;
+  }
+
+  auto patchJump(std::size_t offset) -> void {
+    auto&& code = current->function->chunk.code;
+
+    // -2 to adjust for the bytecode for the jump offset itself.
+    auto&& jump = checkIndex(code.size() - offset - 2, "Too much code to jump over.");
+    code[offset] = static_cast<std::uint8_t>(jump >> 8);
+    code[offset + 1] = static_cast<std::uint8_t>(jump & 0xff);
+  }
+
+  auto emitLoop(std::size_t loopStart) -> void {
+    emit(OpCode::LOOP);
+
+    auto&& offset = current->function->chunk.code.size() - loopStart + 2;
+    emitShort(checkIndex(offset, "Loop body too large."));
+  }
+
+  auto emitReturn() -> void {
+    emit(OpCode::NIL);
+    emit(OpCode::RETURN);
+  }
+
+  auto emit(OpCode op) -> void {
+    current->function->chunk.write(op, line);
+  }
+
+  auto emitByte(std::uint8_t byte) -> void {
+    current->function->chunk.write(byte, line);
+  }
+
+  auto emitShort(std::uint16_t value) -> void {
+    emitByte(static_cast<std::uint8_t>(value >> 8));
+    emitByte(static_cast<std::uint8_t>(value & 0xff));
+  }
+
+  auto checkIndex(std::size_t index, const std::string& message) -> std::uint16_t {
+    if (index > std::numeric_limits<std::uint16_t>::max()) fail(message);
+    return static_cast<std::uint16_t>(index);
+  }
+
+  [[noreturn]]
+  auto fail(const std::string& message) -> void {
+    diagnostics.error(line, message);
+    throw CompileError{};
+  }
+};
+}
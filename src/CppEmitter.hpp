@@ -0,0 +1,315 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "Object.hpp"
+#include "TokenType.hpp"
+
+#include <boost/hana/functional/overload_linearly.hpp>
+#include <fmt/format.h>
+
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+namespace lox {
+// Translates a resolved program into a C++ translation unit built on
+// Runtime.hpp, for --emit-cpp.
+//
+// Globals become Runtime::Globals in a Program object that main() creates
+// and destroys, so no value outlives the per-thread string table. Locals
+// become C++ variables in the matching C++ blocks, except those a nested
+// function refers to: these live in a shared cell that the function's
+// lambda captures, which keeps them alive and shared like an Environment
+// slot would. Lox functions become lambdas wrapped as Natives.
+//
+// Values are reference counted without the Heap's cycle collector, so a
+// closure that can reach itself is only freed when the program exits.
+struct CppEmitter {
+  struct Scope {
+    std::unordered_map<std::string_view, const void*> names = {};
+    // How many functions enclose the scope.
+    std::size_t function = {};
+  };
+
+  // Declarations (Var, Function and parameter Token nodes) that a nested
+  // function refers to, found by a first pass.
+  std::unordered_set<const void*> captured = {};
+  std::unordered_map<const void*, std::string> identifiers = {};
+  std::set<std::string_view> globals = {"clock"};
+  std::vector<std::string> strings = {};
+  std::vector<Scope> scopes = {};
+  std::size_t function = {};
+  std::size_t temporaries = {};
+  bool analyzing = {};
+  std::string code = {};
+  std::size_t indent = 2;
+
+  static auto emit(std::span<const Stmt> statements, std::string_view path) -> std::string {
+    auto&& emitter = CppEmitter{};
+
+    emitter.analyzing = true;
+    emitter.body(statements);
+    emitter.analyzing = false;
+    emitter.code.clear();
+    emitter.identifiers.clear();
+    emitter.strings.clear();
+    emitter.temporaries = 0;
+    emitter.body(statements);
+
+    auto&& out = fmt::memory_buffer{};
+    auto&& it = std::back_inserter(out);
+    fmt::format_to(it, "// Translated from {} by cxx-lox --emit-cpp. Build it against the\n", path);
+    fmt::format_to(it, "// interpreter's headers, e.g. c++ -std=c++23 -O2 -I<cxx-lox>/src file.cpp -lfmt\n");
+    fmt::format_to(it, "#include \"Runtime.hpp\"\n\nnamespace {{\nusing namespace lox;\n\nstruct Program {{\n");
+    for (auto&& name: emitter.globals) fmt::format_to(it, "  Runtime::Global g_{} = {{}};\n", name);
+    for (std::size_t i = 0; i < emitter.strings.size(); i++) {
+      fmt::format_to(it, "  Object s{} = Runtime::string({});\n", i, emitter.strings[i]);
+    }
+    fmt::format_to(it, "\n  auto run() -> void {{\n    Runtime::define(g_clock, Runtime::clock());\n");
+    fmt::format_to(it, "{}", emitter.code);
+    fmt::format_to(it, "  }}\n}};\n}}\n\nauto main() -> int {{\n  return lox::Runtime::main([] {{ Program{{}}.run(); }});\n}}\n");
+    return fmt::to_string(out);
+  }
+
+  auto line(std::string_view text) -> void {
+    code.append(2 * indent, ' ');
+    code.append(text);
+    code.push_back('\n');
+  }
+
+  auto body(std::span<const Stmt> statements) -> void {
+    for (auto&& statement: statements) emit(statement);
+  }
+
+  // Makes `name` a local of the innermost scope, or a global at the top
+  // level, and returns how code refers to it.
+  auto declare(const Token& name, const void* declaration) -> std::string {
+    if (scopes.empty()) {
+      globals.insert(name.lexeme);
+      return fmt::format("g_{}", name.lexeme);
+    }
+
+    scopes.back().names[name.lexeme] = declaration;
+    auto&& identifier = fmt::format("{}{}_{}", captured.contains(declaration) ? 'c' : 'l', identifiers.size(), name.lexeme);
+    return identifiers[declaration] = identifier;
+  }
+
+  // How code reads or writes a variable, as an lvalue for locals.
+  auto local(const Token& name) -> std::string {
+    for (auto&& scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+      if (auto&& found = scope->names.find(name.lexeme); found != scope->names.end()) {
+        auto* declaration = found->second;
+        if (scope->function < function) captured.insert(declaration);
+        if (analyzing) return {};
+        return captured.contains(declaration) ? fmt::format("(*{})", identifiers[declaration]) : identifiers[declaration];
+      }
+    }
+    return {};
+  }
+
+  // A declaration's initialization, as a statement.
+  auto define(const Token& name, const void* declaration, const std::string& value) -> void {
+    auto&& identifier = declare(name, declaration);
+    if (scopes.empty()) {
+      line(fmt::format("Runtime::define({}, {});", identifier, value));
+    } else if (captured.contains(declaration)) {
+      line(fmt::format("auto {} = std::make_shared<Object>({});", identifier, value));
+    } else {
+      line(fmt::format("auto {} = {};", identifier, value));
+    }
+  }
+
+  static auto quote(std::string_view text) -> std::string {
+    auto&& quoted = std::string{"\""};
+    for (auto&& c: text) {
+      if (c == '"' || c == '\\') {
+        quoted += '\\';
+        quoted += c;
+      } else if (c == '\n') {
+        quoted += "\\n";
+      } else if (static_cast<unsigned char>(c) < 0x20 || static_cast<unsigned char>(c) >= 0x7f) {
+        quoted += fmt::format("\\{:03o}", static_cast<unsigned char>(c));
+      } else {
+        quoted += c;
+      }
+    }
+    return quoted + '"';
+  }
+
+  auto emit(const Stmt& statement) -> void {
+    using namespace boost::hana;
+    using namespace fmt;
+    using namespace std;
+
+    visit(overload_linearly(
+      [](std::monostate) {},
+      [this](Block* stmt) {
+        line("{");
+        indent++;
+        scopes.push_back(Scope{{}, function});
+        body(stmt->statements);
+        scopes.pop_back();
+        indent--;
+        line("}");
+      },
+      [this](Expression* stmt) { line(format("static_cast<void>({});", emit(stmt->expression))); },
+      [this](Function* stmt) {
+        auto&& identifier = declare(stmt->name, stmt);
+        if (!scopes.empty() && captured.contains(stmt)) {
+          // Declared first so the function can refer to itself.
+          line(format("auto {} = std::make_shared<Object>();", identifier));
+          identifier = format("*{}", identifier);
+        }
+
+        function++;
+        scopes.push_back(Scope{{}, function});
+        auto&& parameters = vector<string>{};
+        auto&& cells = vector<string>{};
+        for (auto&& param: stmt->params) {
+          auto&& name = declare(param, &param);
+          if (captured.contains(&param)) {
+            parameters.push_back(format("Object a_{}", name));
+            cells.push_back(format("auto {0} = std::make_shared<Object>(std::move(a_{0}));", name));
+          } else {
+            parameters.push_back(format("Object {}", name));
+          }
+        }
+
+        auto&& header = format("Runtime::function(\"{}\", [=, this]({}) -> Object {{", stmt->name.lexeme, join(parameters, ", "));
+        if (scopes.size() == 1) {
+          line(format("Runtime::define({}, {}", identifier, header));
+        } else if (identifier.starts_with("*")) {
+          line(format("{} = {}", identifier, header));
+        } else {
+          line(format("auto {} = Object{{{}", identifier, header));
+        }
+        indent++;
+        for (auto&& cell: cells) line(cell);
+        body(stmt->body);
+        if (stmt->body.empty() || !holds_alternative<Return*>(stmt->body.back())) line("return Object{};");
+        indent--;
+        line(scopes.size() == 1 ? "}));" : identifier.starts_with("*") ? "});" : "})};");
+        scopes.pop_back();
+        function--;
+      },
+      [this](IfStmt* stmt) {
+        line(format("if (isTruthy({})) {{", emit(stmt->condition)));
+        nested(stmt->thenBranch);
+        if (!holds_alternative<std::monostate>(stmt->elseBranch)) {
+          line("} else {");
+          nested(stmt->elseBranch);
+        }
+        line("}");
+      },
+      [this](Print* stmt) { line(format("Runtime::print({});", emit(stmt->expression))); },
+      [this](Return* stmt) { line(format("return {};", emit(stmt->value))); },
+      [this](Var* stmt) { define(stmt->name, stmt, emit(stmt->initializer)); },
+      [this](While* stmt) {
+        if (holds_alternative<std::monostate>(stmt->condition)) {
+          line("for (;;) {");
+        } else {
+          line(format("while (isTruthy({})) {{", emit(stmt->condition)));
+        }
+        nested(stmt->body);
+        line("}");
+      }
+    ), statement);
+  }
+
+  auto nested(const Stmt& statement) -> void {
+    indent++;
+    emit(statement);
+    indent--;
+  }
+
+  auto emit(const Expr& expression) -> std::string {
+    using enum TokenType;
+    using namespace boost::hana;
+    using namespace fmt;
+    using namespace std;
+
+    return visit(overload_linearly(
+      [](std::monostate) -> string { return "Object{}"; },
+      [this](Assign* expr) -> string {
+        auto&& value = emit(expr->value);
+        if (!expr->binding) {
+          globals.insert(expr->name.lexeme);
+          return format("Runtime::assign(g_{0}, {1}, \"{0}\", {2})", expr->name.lexeme, value, expr->name.line);
+        }
+        return format("Object{{{} = {}}}", local(expr->name), value);
+      },
+      [this](Binary* expr) -> string {
+        auto&& operands = format("{{{}, {}}}", emit(expr->left), emit(expr->right));
+        auto&& at = expr->op.line;
+        switch (expr->op.type) {
+          case GREATER: return format("Runtime::greater({}, {})", operands, at);
+          case GREATER_EQUAL: return format("Runtime::greaterEqual({}, {})", operands, at);
+          case LESS: return format("Runtime::less({}, {})", operands, at);
+          case LESS_EQUAL: return format("Runtime::lessEqual({}, {})", operands, at);
+          case MINUS: return format("Runtime::subtract({}, {})", operands, at);
+          case PLUS: return format("Runtime::add({}, {})", operands, at);
+          case SLASH: return format("Runtime::divide({}, {})", operands, at);
+          case STAR: return format("Runtime::multiply({}, {})", operands, at);
+          case BANG_EQUAL: return format("Runtime::notEqual({})", operands);
+          case EQUAL_EQUAL: return format("Runtime::equal({})", operands);
+          default: return format("(static_cast<void>(Runtime::Operands{}), Object{{}})", operands);
+        }
+      },
+      [this](Call* expr) -> string {
+        auto&& values = vector<string>{emit(expr->callee)};
+        for (auto&& argument: expr->arguments) values.push_back(emit(argument));
+        return format("Runtime::call(std::array<Object, {}>{{{}}}, {})", values.size(), join(values, ", "), expr->paren.line);
+      },
+      [this](Grouping* expr) -> string { return emit(expr->expression); },
+      [this](Literal* expr) -> string {
+        auto&& value = expr->value;
+        if (isNil(value)) return "Object{}";
+        if (isBool(value)) return asBool(value) ? "Object{true}" : "Object{false}";
+        if (isNumber(value)) return format("Object{{{}}}", literal(asNumber(value)));
+        if (isString(value)) {
+          strings.push_back(quote(asString(value)));
+          return format("s{}", strings.size() - 1);
+        }
+        return "Object{}";
+      },
+      [this](Logical* expr) -> string {
+        auto&& temporary = format("t{}", temporaries++);
+        auto&& test = expr->op.type == OR ? "" : "!";
+        return format("[&]() -> Object {{ auto {0} = {1}; return {2}isTruthy({0}) ? {0} : {3}; }}()", temporary, emit(expr->left), test, emit(expr->right));
+      },
+      [this](Unary* expr) -> string {
+        switch (expr->op.type) {
+          case BANG: return format("Object{{!isTruthy({})}}", emit(expr->right));
+          case MINUS: return format("Runtime::negate({}, {})", emit(expr->right), expr->op.line);
+          default: return format("(static_cast<void>({}), Object{{}})", emit(expr->right));
+        }
+      },
+      [this](Variable* expr) -> string {
+        if (!expr->binding) {
+          globals.insert(expr->name.lexeme);
+          return format("Runtime::get(g_{0}, \"{0}\", {1})", expr->name.lexeme, expr->name.line);
+        }
+        return format("Object{{{}}}", local(expr->name));
+      }
+    ), expression);
+  }
+
+  // A C++ double literal for `value`. Constants the Optimizer folded to an
+  // infinity or NaN are spelled by their bits, sign included.
+  static auto literal(double value) -> std::string {
+    if (!std::isfinite(value)) return fmt::format("std::bit_cast<double>(std::uint64_t{{{:#x}}})", std::bit_cast<std::uint64_t>(value));
+
+    auto&& text = fmt::format("{}", value);
+    if (text.find_first_of(".e") == std::string::npos) text += ".0";
+    return text;
+  }
+};
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "RuntimeError.hpp"
+#include "TokenType.hpp"
+
+#include <fmt/format.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace lox {
+// Destination for text a program prints or for the errors it raises.
+using Sink = std::function<void(std::string_view)>;
+
+inline auto fileSink(std::FILE* file) -> Sink {
+  return [file](std::string_view text) { std::fwrite(text.data(), 1, text.size(), file); };
+}
+
+// Formats into a local buffer and hands the result to `sink` in one piece.
+template<typename... T>
+auto emit(const Sink& sink, fmt::format_string<T...> format, T&&... args) -> void {
+  auto&& buffer = fmt::memory_buffer{};
+  fmt::format_to(std::back_inserter(buffer), format, std::forward<T>(args)...);
+  sink(std::string_view{buffer.data(), buffer.size()});
+}
+
+// Static and runtime errors of one Session. Every component that can report
+// an error holds a reference to it, so sessions on different threads never
+// share state.
+struct Diagnostics {
+  Sink sink = fileSink(stdout);
+  bool hadError = {};
+  bool hadRuntimeError = {};
+
+  auto report(std::size_t line, std::string_view where, std::string_view message) -> void {
+    emit(sink, "[line {}] Error {}: {}\n", line, where, message);
+    hadError = true;
+  }
+
+  auto error(const Token& token, std::string_view message) -> void {
+    using enum TokenType;
+
+    if (token.type == LOX_EOF) {
+      report(token.line, " at end", message);
+    } else {
+      report(token.line, " at '" + std::string{token.lexeme} + "'", message);
+    }
+  }
+
+  auto error(std::size_t line, std::string_view message) -> void {
+    report(line, "", message);
+  }
+
+  auto runtimeError(const RuntimeError& error) -> void {
+    emit(sink, "{} \n[line {} ]", error.what(), error.token.line);
+    hadRuntimeError = true;
+  }
+
+  auto reset() -> void {
+    hadError = false;
+    hadRuntimeError = false;
+  }
+};
+}
@@ -1,49 +1,54 @@
 #pragma once
 
 #include "Object.hpp"
-#include "RuntimeError.hpp"
-#include "TokenType.hpp"
+#include "Symbol.hpp"
 
-#include <fmt/format.h>
-
-#include <string>
-#include <unordered_map>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <vector>
 
 namespace lox {
+// Globals are stored in `values`, indexed by the interned Symbol of their
+// name; locals live in `slots` at the index the Resolver assigned to them, so
+// reading one is a pointer walk of `depth` hops plus a vector index.
 struct Environment {
   std::shared_ptr<Environment> enclosing;
-  std::unordered_map<std::string, Object> values;
+  std::vector<std::optional<Object>> values;
+  std::vector<Object> slots;
+  // Whether the Heap is watching this environment for cycles.
+  bool tracked = {};
+
+  auto find(Symbol symbol) -> std::optional<Object>* {
+    if (symbol >= values.size() || !values[symbol]) return nullptr;
+    return &values[symbol];
+  }
 
-  auto get(const Token& name) -> Object {
-    using namespace fmt;
+  auto define(Symbol name, const Object& value) -> void {
+    if (name >= values.size()) values.resize(name + 1);
+    values[name] = value;
+  }
 
-    if (values.contains(name.lexeme)) {
-      return values[name.lexeme];
+  auto ancestor(std::size_t depth) -> Environment* {
+    auto environment = this;
+    for (std::size_t i = 0; i < depth; i++) {
+      environment = environment->enclosing.get();
     }
 
-    if (enclosing) return enclosing->get(name);
-
-    throw RuntimeError{name, format("Undefined variable '{}'.", name.lexeme)};
+    return environment;
   }
-  
-  auto assign(const Token& name, const Object& value) -> void {
-    using namespace fmt;
 
-    if (values.contains(name.lexeme)) {
-      values[name.lexeme] = value;
-      return;
-    }
-
-    if (enclosing) {
-      enclosing->assign(name, value);
-      return;
-    }
+  auto getAt(std::size_t depth, std::size_t slot) -> const Object& {
+    return ancestor(depth)->slots[slot];
+  }
 
-    throw RuntimeError{name, format("Undefined variable {}.", name.lexeme)};
+  auto assignAt(std::size_t depth, std::size_t slot, const Object& value) -> void {
+    ancestor(depth)->slots[slot] = value;
   }
 
-  auto define(const std::string& name, const Object& value) -> void {
-    values.insert({name, value});
+  auto defineAt(std::size_t slot, Object value) -> void {
+    if (slot >= slots.size()) slots.resize(slot + 1);
+    slots[slot] = std::move(value);
   }
 };
 }
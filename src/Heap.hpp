@@ -0,0 +1,345 @@
+#pragma once
+
+#include "Chunk.hpp"
+#include "Environment.hpp"
+#include "LoxCallable.hpp"
+#include "LoxFunction.hpp"
+#include "Object.hpp"
+#include "Stats.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace lox {
+// Cycle collector for the objects that can reference each other: captured
+// tree-walker Environments, VM Upvalues and the functions stored in them. Reference
+// counting still frees everything acyclic as soon as it dies; the Heap only
+// has to find garbage that keeps itself alive through a cycle. Strings can
+// never be part of one, so they are not managed here at all.
+//
+// A collection is trial deletion over the tracked objects, as in CPython's
+// collector. Every object's strong count is compared with the references
+// held by other tracked objects; whatever has more is held from outside (an
+// interpreter member, the VM stack, a C++ local in the middle of an
+// evaluation) and becomes a root. Everything the roots reach survives, and
+// the rest has its outgoing references cleared, which breaks the cycles and
+// lets reference counting free them. Because roots are derived from the
+// counts, a collection is safe at any point, including in the middle of
+// evaluating an expression.
+//
+// The generations hold weak_ptrs. Objects come from make_shared, so an entry
+// keeps the memory of an object that has already died allocated until the
+// entry is dropped; entries of dead objects are dropped by each collection
+// and whenever a generation would otherwise have to grow.
+//
+// Objects start in a young generation that is collected whenever
+// YOUNG_BYTES worth of them are tracked and still alive. Survivors move to
+// the old generation, which is only included once it has doubled since the
+// last full collection.
+struct Heap {
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::size_t YOUNG_BYTES = 1 << 20;
+  static constexpr std::size_t MIN_FULL_ENTRIES = 4096;
+
+  template<typename T>
+  struct Generations {
+    std::vector<std::weak_ptr<T>> young = {};
+    std::vector<std::weak_ptr<T>> old = {};
+  };
+
+  struct Node {
+    enum class Kind: std::uint8_t {
+      ENVIRONMENT,
+      UPVALUE,
+      CALLABLE,
+      FUNCTION,
+      CLOSURE,
+    };
+
+    Kind kind;
+    const void* object = {};
+    long refs = {};
+    bool reachable = {};
+  };
+
+  // Open-addressing map from object address to node number. Every edge is
+  // looked up several times per collection, which made std::unordered_map
+  // the largest part of the pause.
+  struct Index {
+    static constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+
+    std::vector<std::pair<const void*, std::size_t>> slots = {};
+    std::size_t count = {};
+
+    auto reserve(std::size_t entries) -> void {
+      auto&& capacity = std::bit_ceil(std::max<std::size_t>(16, 2 * entries));
+      if (capacity <= slots.size()) return;
+
+      auto&& old = std::exchange(slots, std::vector<std::pair<const void*, std::size_t>>(capacity));
+      for (auto&& [key, value]: old) {
+        if (key) slots[probe(key)] = {key, value};
+      }
+    }
+
+    // The node number for `key`, or NONE.
+    auto find(const void* key) const -> std::size_t {
+      auto&& slot = slots[probe(key)];
+      return slot.first ? slot.second : NONE;
+    }
+
+    auto insert(const void* key, std::size_t value) -> bool {
+      if (2 * (count + 1) > slots.size()) reserve(count + 1);
+
+      auto&& slot = slots[probe(key)];
+      if (slot.first) return false;
+
+      slot = {key, value};
+      count++;
+      return true;
+    }
+
+    // The slot holding `key`, or the empty one where it would go.
+    auto probe(const void* key) const -> std::size_t {
+      auto&& mask = slots.size() - 1;
+      auto&& i = static_cast<std::size_t>((reinterpret_cast<std::uintptr_t>(key) >> 4) * 0x9e3779b97f4a7c15ULL) & mask;
+      while (slots[i].first && slots[i].first != key) i = (i + 1) & mask;
+      return i;
+    }
+  };
+
+  Generations<Environment> environments = {};
+  Generations<Upvalue> upvalues = {};
+  // Bytes of objects tracked since the last collection.
+  std::size_t allocated = {};
+  std::size_t oldAfterFull = {};
+  GcStats stats = {};
+
+  // Called when a function closes over `environment`. Every cycle runs
+  // through some function's closure and from there only up the enclosing
+  // chain, so environments that were never captured (most blocks and calls)
+  // need not be tracked at all.
+  auto track(const std::shared_ptr<Environment>& environment) -> void {
+    for (auto current = environment; current && !current->tracked; current = current->enclosing) {
+      current->tracked = true;
+      track(environments, current);
+    }
+  }
+
+  auto track(const std::shared_ptr<Upvalue>& upvalue) -> void {
+    track(upvalues, upvalue);
+  }
+
+  template<typename T>
+  auto track(Generations<T>& generations, const std::shared_ptr<T>& object) -> void {
+    // What reference counting has freed since no longer counts towards the
+    // next collection.
+    auto&& dropped = append(generations.young, object);
+    allocated -= std::min(allocated, dropped * sizeof(T));
+    allocated += sizeof(T);
+    if (allocated >= YOUNG_BYTES) collect();
+  }
+
+  // Adds `object` to `entries`, first dropping the entries of dead objects
+  // if it is full. Returns how many were dropped.
+  template<typename T>
+  static auto append(std::vector<std::weak_ptr<T>>& entries, const std::shared_ptr<T>& object) -> std::size_t {
+    auto&& dropped = std::size_t{};
+    if (entries.size() == entries.capacity()) {
+      dropped = std::erase_if(entries, [](auto&& entry) { return entry.expired(); });
+      // Still more than half full: grow now rather than scan again soon.
+      if (2 * entries.size() > entries.capacity()) entries.reserve(2 * entries.capacity());
+    }
+    entries.push_back(object);
+    return dropped;
+  }
+
+  auto collect() -> void {
+    auto&& old = environments.old.size() + upvalues.old.size();
+    collect(old >= std::max(MIN_FULL_ENTRIES, 2 * oldAfterFull));
+  }
+
+  auto collect(bool full) -> void {
+    using enum Node::Kind;
+    using namespace std;
+
+    auto&& start = Clock::now();
+
+    auto&& nodes = vector<Node>{};
+    auto&& index = Index{};
+    auto&& add = [&](Node::Kind kind, const void* object, long refs) {
+      if (index.insert(object, nodes.size())) nodes.push_back(Node{kind, object, refs});
+    };
+
+    // Holding the candidates keeps them alive until the collection is over; the
+    // extra reference each one gains is not counted.
+    auto&& liveEnvironments = lock(environments, full);
+    auto&& liveUpvalues = lock(upvalues, full);
+    // Most candidates bring a function along.
+    nodes.reserve(2 * (liveEnvironments.size() + liveUpvalues.size()));
+    index.reserve(nodes.capacity());
+    for (auto&& environment: liveEnvironments) add(ENVIRONMENT, environment.get(), environment.use_count() - 1);
+    for (auto&& upvalue: liveUpvalues) add(UPVALUE, upvalue.get(), upvalue.use_count() - 1);
+
+    // Functions are not tracked themselves; they join the graph when a
+    // tracked object refers to them.
+    for (size_t i = 0; i < nodes.size(); i++) {
+      edges(nodes[i], [&](Node::Kind kind, const void* object, long refs) {
+        if (kind == CALLABLE) add(callableKind(static_cast<const LoxCallable*>(object)), object, refs);
+      });
+    }
+
+    for (auto&& node: nodes) {
+      edges(node, [&](Node::Kind, const void* object, long) {
+        if (auto&& i = index.find(object); i != Index::NONE) nodes[i].refs--;
+      });
+    }
+
+    auto&& pending = vector<size_t>{};
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (nodes[i].refs > 0) {
+        nodes[i].reachable = true;
+        pending.push_back(i);
+      }
+    }
+    while (!pending.empty()) {
+      auto&& node = nodes[pending.back()];
+      pending.pop_back();
+      edges(node, [&](Node::Kind, const void* object, long) {
+        auto&& i = index.find(object);
+        if (i == Index::NONE || nodes[i].reachable) return;
+
+        nodes[i].reachable = true;
+        pending.push_back(i);
+      });
+    }
+
+    // Break the cycles. The references cleared here are only dropped once every
+    // collected object has been visited, so nothing is freed under our feet.
+    auto&& cleared = vector<Object>{};
+    auto&& clearedEnvironments = vector<shared_ptr<Environment>>{};
+    auto&& survivors = [&](auto& live, auto& generations, auto&& clear) {
+      if (full) generations.old.clear();
+      for (auto&& object: live) {
+        if (nodes[index.find(object.get())].reachable) {
+          append(generations.old, object);
+        } else {
+          clear(*object);
+          stats.freedObjects++;
+        }
+      }
+    };
+    survivors(liveEnvironments, environments, [&](Environment& environment) {
+      stats.freedBytes += sizeof(Environment)
+        + environment.slots.capacity() * sizeof(Object)
+        + environment.values.capacity() * sizeof(optional<Object>);
+      clearedEnvironments.push_back(std::move(environment.enclosing));
+      for (auto&& value: environment.slots) cleared.push_back(std::move(value));
+      for (auto&& value: environment.values) {
+        if (value) cleared.push_back(std::move(*value));
+      }
+      environment.slots.clear();
+      environment.values.clear();
+    });
+    survivors(liveUpvalues, upvalues, [&](Upvalue& upvalue) {
+      stats.freedBytes += sizeof(Upvalue);
+      cleared.push_back(std::move(upvalue.closed));
+    });
+
+    if (full) {
+      oldAfterFull = environments.old.size() + upvalues.old.size();
+      stats.full++;
+    } else {
+      stats.minor++;
+    }
+    allocated = 0;
+
+    cleared.clear();
+    clearedEnvironments.clear();
+    liveEnvironments.clear();
+    liveUpvalues.clear();
+
+    auto&& pause = Clock::now() - start;
+    stats.pause += pause;
+    stats.maxPause = max(stats.maxPause, pause);
+  }
+
+  // Strong references to the objects in the generations being collected,
+  // dropping entries whose object has already been freed.
+  template<typename T>
+  static auto lock(Generations<T>& generations, bool full) -> std::vector<std::shared_ptr<T>> {
+    auto&& live = std::vector<std::shared_ptr<T>>{};
+    auto&& take = [&](std::vector<std::weak_ptr<T>>& entries) {
+      for (auto&& entry: entries) {
+        if (auto&& object = entry.lock()) live.push_back(std::move(object));
+      }
+      entries.clear();
+    };
+
+    take(generations.young);
+    if (full) take(generations.old);
+    return live;
+  }
+
+  // Callables that can reference other objects get a kind of their own;
+  // natives are plain CALLABLEs without edges.
+  static auto callableKind(const LoxCallable* callable) -> Node::Kind {
+    using enum Node::Kind;
+
+    if (dynamic_cast<const LoxFunction*>(callable)) return FUNCTION;
+    if (dynamic_cast<const VmClosure*>(callable)) return CLOSURE;
+    return CALLABLE;
+  }
+
+  // Calls `edge(kind, object, strongCount)` for every reference `node` holds
+  // to an object that may be part of a cycle.
+  template<typename F>
+  static auto edges(const Node& node, F&& edge) -> void {
+    using enum Node::Kind;
+
+    auto&& value = [&](const Object& object) {
+      if (!isCallable(object)) return;
+      auto&& callable = asCallable(object);
+      edge(CALLABLE, &callable, static_cast<long>(callable.refs));
+    };
+
+    switch (node.kind) {
+      case ENVIRONMENT: {
+        auto* environment = static_cast<const Environment*>(node.object);
+        if (environment->enclosing) edge(ENVIRONMENT, environment->enclosing.get(), environment->enclosing.use_count());
+        for (auto&& slot: environment->slots) value(slot);
+        for (auto&& global: environment->values) {
+          if (global) value(*global);
+        }
+        break;
+      }
+      case UPVALUE: {
+        auto* upvalue = static_cast<const Upvalue*>(node.object);
+        if (upvalue->location == &upvalue->closed) value(upvalue->closed);
+        break;
+      }
+      case CALLABLE:
+        break;
+      case FUNCTION: {
+        auto* function = static_cast<const LoxFunction*>(static_cast<const LoxCallable*>(node.object));
+        if (function->closure) edge(ENVIRONMENT, function->closure.get(), function->closure.use_count());
+        break;
+      }
+      case CLOSURE: {
+        auto* closure = static_cast<const VmClosure*>(static_cast<const LoxCallable*>(node.object));
+        for (auto&& upvalue: closure->upvalues) {
+          if (upvalue) edge(UPVALUE, upvalue.get(), upvalue.use_count());
+        }
+        break;
+      }
+    }
+  }
+};
+}
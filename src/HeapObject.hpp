@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace lox {
+// Header of every reference-counted runtime object: strings and callables.
+// The count lives in the object itself, so a value holds a single pointer
+// and a NaN-boxed value can point straight at the object. Counts are not
+// atomic: a value never leaves the interpreter instance that created it.
+//
+// The count comes first and the struct has no vtable, so generated code can
+// take a reference with one `inc dword [object]` (see Jit). Objects are
+// freed through `destroy`, which each derived type sets to delete itself.
+struct HeapObject {
+  enum class Kind: std::uint8_t {
+    STRING,
+    CALLABLE,
+  };
+
+  mutable std::uint32_t refs = {};
+  Kind kind;
+  void (*destroy)(const HeapObject*);
+
+  HeapObject(Kind kind, void (*destroy)(const HeapObject*)):
+    kind(kind),
+    destroy(destroy)
+  {}
+
+  HeapObject(const HeapObject&) = delete;
+  auto operator=(const HeapObject&) -> HeapObject& = delete;
+
+  auto retain() const -> void {
+    refs++;
+  }
+
+  auto release() const -> void {
+    if (--refs == 0) destroy(this);
+  }
+
+  // A `destroy` for objects whose most derived type is T, or whose T has a
+  // virtual destructor.
+  template<typename T>
+  static auto destroyAs(const HeapObject* object) -> void {
+    delete static_cast<const T*>(object);
+  }
+};
+
+static_assert(std::is_standard_layout_v<HeapObject> && offsetof(HeapObject, refs) == 0);
+
+// Owning pointer to a HeapObject, like std::shared_ptr without the separate
+// control block.
+template<typename T>
+struct Ref {
+  T* object = {};
+
+  Ref() = default;
+
+  Ref(std::nullptr_t) {}
+
+  // Takes a new reference to `object`, which may already have others.
+  explicit Ref(T* object):
+    object(object)
+  {
+    if (object) header()->retain();
+  }
+
+  Ref(const Ref& other):
+    Ref(other.object)
+  {}
+
+  Ref(Ref&& other) noexcept:
+    object(std::exchange(other.object, nullptr))
+  {}
+
+  template<typename U>
+    requires std::is_convertible_v<U*, T*>
+  Ref(const Ref<U>& other):
+    Ref(static_cast<T*>(other.object))
+  {}
+
+  template<typename U>
+    requires std::is_convertible_v<U*, T*>
+  Ref(Ref<U>&& other) noexcept:
+    object(std::exchange(other.object, nullptr))
+  {}
+
+  auto operator=(Ref other) noexcept -> Ref& {
+    std::swap(object, other.object);
+    return *this;
+  }
+
+  ~Ref() {
+    reset();
+  }
+
+  template<typename... Args>
+  static auto make(Args&&... args) -> Ref {
+    return Ref{new T(std::forward<Args>(args)...)};
+  }
+
+  auto reset() -> void {
+    if (auto* old = std::exchange(object, nullptr)) header(old)->release();
+  }
+
+  auto get() const -> T* {
+    return object;
+  }
+
+  auto operator*() const -> T& {
+    return *object;
+  }
+
+  auto operator->() const -> T* {
+    return object;
+  }
+
+  explicit operator bool() const {
+    return object != nullptr;
+  }
+
+  auto use_count() const -> long {
+    return object ? static_cast<long>(header()->refs) : 0;
+  }
+
+  friend auto operator==(const Ref& left, const Ref& right) -> bool {
+    return left.object == right.object;
+  }
+
+  auto header() const -> const HeapObject* {
+    return header(object);
+  }
+
+  static auto header(T* object) -> const HeapObject* {
+    return static_cast<const HeapObject*>(object);
+  }
+};
+}
@@ -1,160 +1,209 @@
 #pragma once
 
 #include "Ast.hpp"
+#include "Diagnostics.hpp"
 #include "Environment.hpp"
-#include "Lox.hpp"
+#include "Heap.hpp"
 #include "LoxCallable.hpp"
 #include "LoxFunction.hpp"
+#include "Native.hpp"
 #include "Object.hpp"
-#include "Return.hpp"
+#include "Profiler.hpp"
 #include "RuntimeError.hpp"
+#include "Stats.hpp"
 
 #include <boost/hana/functional/overload_linearly.hpp>
 #include <fmt/format.h>
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <typeinfo>
+#include <utility>
 #include <variant>
+#include <vector>
 
 namespace lox {
+// Outcome of executing a statement. RETURN leaves the value in
+// Interpreter::returnValue and ERROR leaves the error in Interpreter::error;
+// both unwind by being handed back up through execute() instead of by
+// throwing, so a Lox `return` costs a branch rather than a C++ exception.
+enum class Completion: std::uint8_t {
+  NORMAL,
+  RETURN,
+  ERROR,
+};
+
 struct Interpreter {
+  // Most environments pooled for reuse at once.
+  static constexpr std::size_t POOL_MAX = 1024;
+
+  Diagnostics& diagnostics;
+  // Where `print` writes.
+  Sink output = {};
   std::shared_ptr<Environment> globals = std::make_shared<Environment>();
   std::shared_ptr<Environment> environment = globals;
-
-  auto isTruthy(const Object& object) -> bool {
-    using namespace boost::hana;
-    using namespace std;
-
-    return visit(overload_linearly(
-      [](std::monostate) { return false; },
-      [](bool val) { return val; },
-      [](auto&&) { return true; }
-    ), object);
+  Object returnValue = {};
+  // Arguments of the calls being set up, innermost last. Each call pushes
+  // its arguments and pops them once the callee returns, so the vector stops
+  // growing at the deepest nesting it has seen.
+  std::vector<Object> arguments = {};
+  // Environments of finished calls and blocks that nothing else referred
+  // to, emptied and ready for the next one.
+  std::vector<std::shared_ptr<Environment>> pool = {};
+  // Set by fail(). evaluate() returns nil once it is set, and every caller
+  // checks it before using a result.
+  std::optional<RuntimeError> error = {};
+  Counters counters = {};
+  Heap heap = {};
+  Profiler* profiler = {};
+
+  explicit Interpreter(Diagnostics& diagnostics, Sink output = fileSink(stdout)):
+    diagnostics(diagnostics),
+    output(std::move(output))
+  {}
+
+  Interpreter(const Interpreter&) = delete;
+  auto operator=(const Interpreter&) -> Interpreter& = delete;
+
+  // Functions defined at the top level close over globals, so the globals
+  // are part of a cycle that only the Heap can take apart.
+  ~Interpreter() {
+    environment.reset();
+    globals.reset();
+    returnValue = {};
+    heap.collect(true);
   }
 
-  auto isEqual(const Object& left, const Object& right) -> bool {
-    using namespace boost::hana;
-    using namespace std;
+  auto acquire(std::shared_ptr<Environment> enclosing) -> std::shared_ptr<Environment> {
+    if (pool.empty()) {
+      counters.environments++;
+      return std::make_shared<Environment>(std::move(enclosing));
+    }
 
-    return visit(overload_linearly(
-      [](std::monostate, std::monostate) { return true; },
-      [](std::monostate, auto&&) { return false; },
-      [](auto&& left, auto&& right) 
-        requires std::equality_comparable_with<decltype(left), decltype(right)>
-        { return std::equal_to{}(left, right); },
-      [](auto&&, auto&&) { return false; }
-    ), left, right);
+    auto environment = std::move(pool.back());
+    pool.pop_back();
+    environment->enclosing = std::move(enclosing);
+    return environment;
   }
 
-  auto checkNumberOperand(const Token& op, const Object& operand) -> void {
-    using namespace boost::hana;
-    using namespace std;
+  // Returns `environment` to the pool unless a closure or the Heap may still
+  // see it.
+  auto release(std::shared_ptr<Environment>&& environment) -> void {
+    if (environment.use_count() != 1 || environment->tracked || pool.size() == POOL_MAX) return;
 
-    return visit(overload_linearly(
-      [](double) { return; },
-      [op](auto&&) { throw RuntimeError{op, "Operands must be numbers."}; }
-    ), operand);  
+    environment->enclosing.reset();
+    environment->slots.clear();
+    pool.push_back(std::move(environment));
   }
 
-  auto checkNumberOperands(const Token& op, const Object& left, const Object& right) -> void {
-    using namespace boost::hana;
-    using namespace std;
+  auto fail(const Token& token, const std::string& message) -> Object {
+    error.emplace(token, message);
+    return {};
+  }
 
-    return visit(overload_linearly(
-      [](double, double) { return; },
-      [op](auto&&, auto&&) { throw RuntimeError{op, "Operands must be numbers."}; }
-    ), left, right);
+  auto checkNumberOperand(const Token& op, const Object& operand) -> bool {
+    if (isNumber(operand)) return true;
+    fail(op, "Operand must be a number.");
+    return false;
   }
 
-  auto call(LoxCallable* callable, std::vector<Object>& arguments) -> Object {
-    using namespace std;    
+  auto checkNumberOperands(const Token& op, const Object& left, const Object& right) -> bool {
+    if (isNumber(left) && isNumber(right)) return true;
+    fail(op, "Operands must be numbers.");
+    return false;
   }
 
   auto evaluate(const Expr& expression) -> Object {
     using enum TokenType;
     using namespace boost::hana;
+    using namespace fmt;
     using namespace std;
 
+    counters.expressions++;
     return visit(overload_linearly(
       [](std::monostate) -> Object { return std::monostate{}; },
-      [this](const unique_ptr<Assign>& expr) -> Object {
+      [this](Assign* expr) -> Object {
         auto&& value = evaluate(expr->value);
-        environment->assign(expr->name, value);
+        if (error) return {};
+
+        if (expr->binding) {
+          environment->assignAt(expr->binding->depth, expr->binding->slot, value);
+        } else if (auto&& global = globals->find(expr->name.symbol)) {
+          *global = value;
+        } else {
+          return fail(expr->name, format("Undefined variable {}.", expr->name.lexeme));
+        }
         return value;
       },
-      [this](const unique_ptr<Binary>& expr) -> Object {
+      [this](Binary* expr) -> Object {
         auto&& left = evaluate(expr->left);
+        if (error) return {};
         auto&& right = evaluate(expr->right);
+        if (error) return {};
 
         switch (expr->op.type) {
           case GREATER:
-            checkNumberOperands(expr->op, left, right);
-            return get<double>(left) > get<double>(right);
+            if (!checkNumberOperands(expr->op, left, right)) return {};
+            return asNumber(left) > asNumber(right);
           case GREATER_EQUAL:
-            checkNumberOperands(expr->op, left, right);
-            return get<double>(left) >= get<double>(right);
+            if (!checkNumberOperands(expr->op, left, right)) return {};
+            return asNumber(left) >= asNumber(right);
           case LESS:
-            checkNumberOperands(expr->op, left, right);
-            return get<double>(left) < get<double>(right);
+            if (!checkNumberOperands(expr->op, left, right)) return {};
+            return asNumber(left) < asNumber(right);
           case LESS_EQUAL:
-            checkNumberOperands(expr->op, left, right);
-            return get<double>(left) <= get<double>(right);
+            if (!checkNumberOperands(expr->op, left, right)) return {};
+            return asNumber(left) <= asNumber(right);
           case BANG_EQUAL:
             return !isEqual(left, right);
           case EQUAL_EQUAL:
             return isEqual(left, right);
           case MINUS:
-            checkNumberOperand(expr->op, right);
-            return get<double>(left) - get<double>(right);
+            if (!checkNumberOperands(expr->op, left, right)) return {};
+            return asNumber(left) - asNumber(right);
           case PLUS:
-            return visit(overload_linearly(
-              [](double left, double right) -> Object {
-                return left + right;
-              },
-              [](const std::string& left, const std::string& right) -> Object {
-                return left + right;              
-              },
-              [&op=expr->op](auto&&, auto&&) -> Object {
-                throw RuntimeError{op, "Operands must be two numbers or two strings"};
-                return std::monostate{};
-              }
-            ), left, right);
+            if (isNumber(left) && isNumber(right)) {
+              return asNumber(left) + asNumber(right);
+            }
+            if (isString(left) && isString(right)) {
+              return LoxString::concat(asLoxString(left), asLoxString(right));
+            }
+            return fail(expr->op, "Operands must be two numbers or two strings");
           case SLASH:
-            checkNumberOperands(expr->op, left, right);
-            return get<double>(left) / get<double>(right);
+            if (!checkNumberOperands(expr->op, left, right)) return {};
+            return asNumber(left) / asNumber(right);
           case STAR:
-            checkNumberOperands(expr->op, left, right);
-            return get<double>(left) * get<double>(right);
+            if (!checkNumberOperands(expr->op, left, right)) return {};
+            return asNumber(left) * asNumber(right);
           default:
             break;
         }
 
-        return monostate{};
+        return std::monostate{};
       },
-      [this](const unique_ptr<Call>& expr) -> Object {
-        using namespace fmt;
-        using namespace std;
-        
+      [this](Call* expr) -> Object {
         auto&& callee = evaluate(expr->callee);
+        if (error) return {};
 
-        auto&& arguments = vector<Object>{};
+        auto&& base = arguments.size();
         for (auto&& argument: expr->arguments) {
-          arguments.emplace_back(evaluate(argument));
+          arguments.push_back(evaluate(argument));
+          if (error) break;
         }
 
-        // auto&& function = get<unique_ptr<LoxCallable>>(callee);
-        // if (!function) {
-        //   throw RuntimeError(expr->paren, "Can only call functions and classes.");
-        // }
-        // if (arguments.size() != function->arity()) {
-        //   throw RuntimeError(expr->paren, format("Expected {} arguments but got {}.", function->arity(), arguments.size()));
-        // }
-
-        // return function->call(*this, std::move(arguments));
+        auto&& result = error ? Object{} : call(*expr, callee, span{arguments}.subspan(base));
+        arguments.resize(base);
+        return result;
       },
-      [this](const unique_ptr<Grouping>& expr) -> Object { return evaluate(expr->expression); },
-      [](const unique_ptr<Literal>& expr) -> Object { return expr->value; },
-      [this](const unique_ptr<Logical>& expr) -> Object {
+      [this](Grouping* expr) -> Object { return evaluate(expr->expression); },
+      [](Literal* expr) -> Object { return expr->value; },
+      [this](Logical* expr) -> Object {
         auto&& left = evaluate(expr->left);
+        if (error) return {};
 
         if (expr->op.type == OR) {
           if (isTruthy(left)) return left;
@@ -164,105 +213,169 @@ struct Interpreter {
 
         return evaluate(expr->right);
       },
-      [this](const unique_ptr<Unary>& expr) -> Object {
+      [this](Unary* expr) -> Object {
         auto&& right = evaluate(expr->right);
+        if (error) return {};
 
         switch (expr->op.type) {
           case BANG:
             return !isTruthy(right);
           case MINUS:
-            return -get<double>(right);
+            if (!checkNumberOperand(expr->op, right)) return {};
+            return -asNumber(right);
           default:
             break;
         }
 
-        return monostate{};
+        return std::monostate{};
       },
-      [this](const std::unique_ptr<Variable>& expr) -> Object {
-        return environment->get(expr->name);
+      [this](Variable* expr) -> Object {
+        if (expr->binding) {
+          return environment->getAt(expr->binding->depth, expr->binding->slot);
+        }
+
+        if (auto&& global = globals->find(expr->name.symbol)) return **global;
+        return fail(expr->name, format("Undefined variable '{}'.", expr->name.lexeme));
       }
     ), expression);
   }
 
-  auto execute(const Stmt& statement) -> void {
-    using enum TokenType;
+  auto execute(const Stmt& statement) -> Completion {
+    using enum Completion;
     using namespace boost::hana;
     using namespace std;
 
+    counters.statements++;
+    if (profiler) profiler->at(statement);
     return visit(overload_linearly(
-      [](std::monostate) { return; },
-      [this](const unique_ptr<Block>& stmt) {
-        executeBlock(stmt->statements, make_shared<Environment>(environment));
+      [](std::monostate) { return NORMAL; },
+      [this](Block* stmt) {
+        auto&& block = acquire(environment);
+        auto&& completion = executeBlock(stmt->statements, block);
+        release(std::move(block));
+        return completion;
       },
-      [this](const unique_ptr<Expression>& stmt) {
+      [this](Expression* stmt) {
         evaluate(stmt->expression);
+        return error ? ERROR : NORMAL;
       },
-      [this](const unique_ptr<Function>& stmt) {
-        using namespace std;
-
-        auto&& function = make_unique<LoxFunction>(stmt.get(), environment);
-        environment->define(stmt->name.lexeme, std::move(function));
+      [this](Function* stmt) {
+        heap.track(environment);
+        auto&& function = Ref<LoxCallable>{Ref<LoxFunction>::make(stmt, environment)};
+        define(stmt->name, stmt->slot, std::move(function));
+        return NORMAL;
       },
-      [this](const unique_ptr<IfStmt>& stmt) {
-        if (isTruthy(evaluate(stmt->condition))) {
-          execute(stmt->thenBranch);
-        } else if (stmt->elseBranch != Stmt{monostate{}}) {
-          execute(stmt->elseBranch);
-        }
+      [this](IfStmt* stmt) {
+        auto&& condition = isTruthy(evaluate(stmt->condition));
+        if (error) return ERROR;
+
+        if (condition) return execute(stmt->thenBranch);
+        return execute(stmt->elseBranch);
       },
-      [this](const unique_ptr<Print>& stmt) {
+      [this](Print* stmt) {
         auto&& value = evaluate(stmt->expression);
-        fmt::print("{}\n", value);
-      },
-      [this](const unique_ptr<Return>& stmt) {
-        using namespace std;
-
-        auto&& value = Object{};
-        if (stmt->value != Expr{monostate{}}) value = evaluate(stmt->value);
+        if (error) return ERROR;
 
-        throw ReturnException{std::move(value)};
+        emit(output, "{}\n", value);
+        return NORMAL;
       },
-      [this](const unique_ptr<Var>& stmt) {
-        auto&& value = Object{};
-        if (stmt->initializer != Expr{monostate{}}) {
-          value = evaluate(stmt->initializer);
-        }
+      [this](Return* stmt) {
+        returnValue = evaluate(stmt->value);
+        return error ? ERROR : RETURN;
+      },
+      [this](Var* stmt) {
+        auto&& value = evaluate(stmt->initializer);
+        if (error) return ERROR;
 
-        environment->define(stmt->name.lexeme, std::move(value));
+        define(stmt->name, stmt->slot, std::move(value));
+        return NORMAL;
       },
-      [this](const unique_ptr<While>& stmt) {
-        while (isTruthy(evaluate(stmt->condition))) {
-          execute(stmt->body);
+      [this](While* stmt) {
+        auto&& forever = holds_alternative<std::monostate>(stmt->condition);
+        for (;;) {
+          if (!forever) {
+            auto&& condition = isTruthy(evaluate(stmt->condition));
+            if (error) return ERROR;
+            if (!condition) return NORMAL;
+          }
+
+          if (auto&& completion = execute(stmt->body); completion != NORMAL) return completion;
         }
       }
     ), statement);
   }
 
-  auto executeBlock(const std::vector<Stmt>& statements, std::shared_ptr<Environment> next) -> void {
-    using namespace std;
+  auto define(const Token& name, std::optional<std::size_t> slot, Object value) -> void {
+    if (slot) {
+      environment->defineAt(*slot, std::move(value));
+    } else {
+      environment->define(name.symbol, std::move(value));
+    }
+  }
 
-    auto&& previous = make_shared<Environment>(environment);
-    try {
-      environment = next;
+  auto call(const Call& expr, const Object& callee, std::span<Object> values) -> Object {
+    using namespace fmt;
 
-      for (auto&& statement: statements) {
-        execute(statement);
-      }
-    } catch (...) {}
+    if (!isCallable(callee)) {
+      return fail(expr.paren, "Can only call functions and classes.");
+    }
+    auto&& function = asCallable(callee);
+    if (values.size() != function.arity()) {
+      return fail(expr.paren, format("Expected {} arguments but got {}.", function.arity(), values.size()));
+    }
 
-    environment = previous;
+    counters.calls++;
+    if (typeid(function) == typeid(Native)) {
+      auto&& result = static_cast<const Native&>(function).invoke(values);
+      return result ? std::move(*result) : fail(expr.paren, result.error());
+    }
+    return function.call(*this, values);
   }
 
-  auto interpret(const std::vector<Stmt>& statements) -> void {
-    using namespace fmt;
+  auto executeBlock(std::span<const Stmt> statements, const std::shared_ptr<Environment>& next) -> Completion {
+    using enum Completion;
+
+    auto previous = std::exchange(environment, next);
+    counters.enter();
+
+    auto&& completion = NORMAL;
+    for (auto&& statement: statements) {
+      completion = execute(statement);
+      if (completion != NORMAL) break;
+    }
 
-    try {
-      for (auto&& statement: statements) {
-        execute(statement);
+    environment = std::move(previous);
+    counters.leave();
+    return completion;
+  }
+
+  auto interpret(std::span<const Stmt> statements) -> void {
+    for (auto&& statement: statements) {
+      if (execute(statement) == Completion::ERROR) {
+        diagnostics.runtimeError(*error);
+        error.reset();
+        return;
       }
-    } catch (const RuntimeError& err) {
-      runtimeError(err);
     }
   }
 };
+
+inline auto LoxFunction::call(Interpreter& interpreter, std::span<Object> arguments) -> Object {
+  using namespace std;
+
+  auto&& environment = interpreter.acquire(closure);
+  for (size_t i = 0; i < arguments.size(); i++) {
+    environment->defineAt(i, std::move(arguments[i]));
+  }
+
+  if (interpreter.profiler) interpreter.profiler->enter(declaration->name.lexeme);
+  auto&& completion = interpreter.executeBlock(declaration->body, environment);
+  if (interpreter.profiler) interpreter.profiler->leave();
+  interpreter.release(std::move(environment));
+
+  if (completion == Completion::RETURN) {
+    return std::exchange(interpreter.returnValue, Object{});
+  }
+  return {};
+}
 }
@@ -0,0 +1,543 @@
+#pragma once
+
+#include "Chunk.hpp"
+#include "Object.hpp"
+#include "Profiler.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+// The JIT emits x86-64 machine code that works on NanBoxed values in place;
+// other targets and the std::variant layout always interpret.
+#if defined(__x86_64__) && defined(__linux__) && LOX_NAN_BOXING
+#define LOX_JIT 1
+#else
+#define LOX_JIT 0
+#endif
+
+namespace lox {
+// Machine code for one VmFunction, in its own executable mapping.
+//
+// The code keeps every value in the function's VM stack slots, exactly where
+// the Vm would have them, so it can hand control back before any
+// instruction: it returns that instruction's bytecode offset and the Vm
+// carries on interpreting from there with the stack depth recorded for it.
+// It can be entered at any reachable instruction the same way.
+struct JitCode {
+  static constexpr std::uint32_t NO_ENTRY = std::numeric_limits<std::uint32_t>::max();
+
+  // Runs from `target` until an instruction the code leaves to the Vm and
+  // returns that instruction's offset.
+  using Entry = auto (*)(Object* slots, void* vm, const void* target) -> std::uint32_t;
+
+  void* memory = {};
+  std::size_t size = {};
+  // Code offset of each bytecode offset's instruction, or NO_ENTRY.
+  std::vector<std::uint32_t> entries = {};
+  // Stack depth, counted from the frame's first slot, before each
+  // instruction.
+  std::vector<std::uint16_t> depths = {};
+
+  JitCode(void* memory, std::size_t size, std::vector<std::uint32_t> entries, std::vector<std::uint16_t> depths):
+    memory(memory),
+    size(size),
+    entries(std::move(entries)),
+    depths(std::move(depths))
+  {}
+
+  JitCode(const JitCode&) = delete;
+  auto operator=(const JitCode&) -> JitCode& = delete;
+
+  ~JitCode() {
+    munmap(memory, size);
+  }
+
+  auto enterable(std::size_t offset) const -> bool {
+    return entries[offset] != NO_ENTRY;
+  }
+
+  auto run(Object* slots, void* vm, std::size_t offset) const -> std::size_t {
+    auto* code = static_cast<const std::uint8_t*>(memory);
+    return std::bit_cast<Entry>(memory)(slots, vm, code + entries[offset]);
+  }
+};
+
+// Copy-and-patch baseline compiler from bytecode to x86-64. Every
+// instruction is translated by copying pre-assembled machine code stencils
+// and patching their trailing holes (stack slot displacements, constants,
+// jump targets, helper addresses); there is no register allocation or
+// instruction selection beyond picking stencils.
+//
+// Numbers take the fast path inline. Guards send anything else (strings,
+// heap values that would need releasing, operand type errors) back to the
+// Vm at that instruction, as do calls, returns, closures and upvalues.
+// Functions are compiled once they have run HOT_THRESHOLD calls or loop
+// iterations.
+struct Jit {
+  static constexpr bool SUPPORTED = LOX_JIT;
+  static constexpr std::uint32_t HOT_THRESHOLD = 1000;
+
+  // Runtime entry points the code calls for globals; each returns false
+  // when the global is undefined, leaving the instruction to the Vm.
+  struct Helpers {
+    using Global = auto (*)(void* vm, std::uint32_t index, Object* slot) -> bool;
+
+    Global getGlobal = {};
+    Global setGlobal = {};
+  };
+
+  static constexpr std::uint64_t QNAN = NanBoxed::QNAN;
+  static constexpr std::uint64_t HEAP_MASK = NanBoxed::SIGN_BIT | NanBoxed::QNAN;
+
+  // Register use: rbx holds the frame's first slot, r12 the Vm, r13 QNAN
+  // and r14 HEAP_MASK; rax, rcx, rdx, xmm0 and xmm1 are scratch.
+  //
+  // push rbx; push r12; push r13; push r14; sub rsp, 8 (keeps calls
+  // aligned); mov rbx, rdi; mov r12, rsi; mov r13, imm64
+  static constexpr std::uint8_t PROLOGUE[] = {0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x48, 0x83, 0xec, 0x08, 0x48, 0x89, 0xfb, 0x49, 0x89, 0xf4, 0x49, 0xbd};
+  // mov r14, imm64
+  static constexpr std::uint8_t LOAD_R14[] = {0x49, 0xbe};
+  // jmp rdx
+  static constexpr std::uint8_t JUMP_RDX[] = {0xff, 0xe2};
+  // add rsp, 8; pop r14; pop r13; pop r12; pop rbx; ret
+  static constexpr std::uint8_t EPILOGUE[] = {0x48, 0x83, 0xc4, 0x08, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3};
+  // mov eax, imm32
+  static constexpr std::uint8_t SET_EAX[] = {0xb8};
+  // jmp rel32
+  static constexpr std::uint8_t JUMP[] = {0xe9};
+
+  // mov rax, [rbx + disp32]
+  static constexpr std::uint8_t LOAD_RAX[] = {0x48, 0x8b, 0x83};
+  // mov rcx, [rbx + disp32]
+  static constexpr std::uint8_t LOAD_RCX[] = {0x48, 0x8b, 0x8b};
+  // mov [rbx + disp32], rax
+  static constexpr std::uint8_t STORE_RAX[] = {0x48, 0x89, 0x83};
+  // mov rax, imm64
+  static constexpr std::uint8_t MOVE_RAX[] = {0x48, 0xb8};
+
+  // mov rdx, rax; not rdx; test rdx, r13; jz rel32
+  static constexpr std::uint8_t EXIT_UNLESS_NUMBER_RAX[] = {0x48, 0x89, 0xc2, 0x48, 0xf7, 0xd2, 0x4c, 0x85, 0xea, 0x0f, 0x84};
+  // mov rdx, rcx; not rdx; test rdx, r13; jz rel32
+  static constexpr std::uint8_t EXIT_UNLESS_NUMBER_RCX[] = {0x48, 0x89, 0xca, 0x48, 0xf7, 0xd2, 0x4c, 0x85, 0xea, 0x0f, 0x84};
+  // mov rdx, rax; not rdx; test rdx, r14; jz rel32
+  static constexpr std::uint8_t EXIT_IF_HEAP_RAX[] = {0x48, 0x89, 0xc2, 0x48, 0xf7, 0xd2, 0x4c, 0x85, 0xf2, 0x0f, 0x84};
+  // mov rdx, rcx; not rdx; test rdx, r14; jz rel32
+  static constexpr std::uint8_t EXIT_IF_HEAP_RCX[] = {0x48, 0x89, 0xca, 0x48, 0xf7, 0xd2, 0x4c, 0x85, 0xf2, 0x0f, 0x84};
+  // Takes a reference to the heap object rax points at, if any:
+  // mov rdx, rax; not rdx; test rdx, r14; jnz +11;
+  // mov rdx, r14; not rdx; and rdx, rax; inc dword [rdx]
+  static constexpr std::uint8_t RETAIN_RAX[] = {
+    0x48, 0x89, 0xc2, 0x48, 0xf7, 0xd2, 0x4c, 0x85, 0xf2, 0x75, 0x0b,
+    0x4c, 0x89, 0xf2, 0x48, 0xf7, 0xd2, 0x48, 0x21, 0xc2, 0xff, 0x02,
+  };
+  // mov rdx, imm64
+  static constexpr std::uint8_t MOVE_RDX[] = {0x48, 0xba};
+  // inc dword [rdx]
+  static constexpr std::uint8_t RETAIN_RDX[] = {0xff, 0x02};
+
+  // movq xmm0, rax; movq xmm1, rcx
+  static constexpr std::uint8_t NUMBERS[] = {0x66, 0x48, 0x0f, 0x6e, 0xc0, 0x66, 0x48, 0x0f, 0x6e, 0xc9};
+  // {add,sub,mul,div}sd xmm0, xmm1
+  static constexpr std::uint8_t ADD[] = {0xf2, 0x0f, 0x58, 0xc1};
+  static constexpr std::uint8_t SUBTRACT[] = {0xf2, 0x0f, 0x5c, 0xc1};
+  static constexpr std::uint8_t MULTIPLY[] = {0xf2, 0x0f, 0x59, 0xc1};
+  static constexpr std::uint8_t DIVIDE[] = {0xf2, 0x0f, 0x5e, 0xc1};
+  // btc rax, 63; movq xmm0, rax
+  static constexpr std::uint8_t NEGATE[] = {0x48, 0x0f, 0xba, 0xf8, 0x3f, 0x66, 0x48, 0x0f, 0x6e, 0xc0};
+  // xmm0 into rax, collapsing NaNs as NanBoxed(double) does:
+  // ucomisd xmm0, xmm0; movq rax, xmm0; jnp +10; mov rax, CANONICAL_NAN
+  static constexpr std::uint8_t BOX_NUMBER[] = {
+    0x66, 0x0f, 0x2e, 0xc0, 0x66, 0x48, 0x0f, 0x7e, 0xc0, 0x7b, 0x0a,
+    0x48, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf8, 0x7f,
+  };
+
+  // Comparisons leave their result in al. Unordered operands (NaN) compare
+  // false, except for NOT_EQUAL.
+  // ucomisd xmm0, xmm1; seta al
+  static constexpr std::uint8_t GREATER[] = {0x66, 0x0f, 0x2e, 0xc1, 0x0f, 0x97, 0xc0};
+  // ucomisd xmm0, xmm1; setae al
+  static constexpr std::uint8_t GREATER_EQUAL[] = {0x66, 0x0f, 0x2e, 0xc1, 0x0f, 0x93, 0xc0};
+  // ucomisd xmm1, xmm0; seta al
+  static constexpr std::uint8_t LESS[] = {0x66, 0x0f, 0x2e, 0xc8, 0x0f, 0x97, 0xc0};
+  // ucomisd xmm1, xmm0; setae al
+  static constexpr std::uint8_t LESS_EQUAL[] = {0x66, 0x0f, 0x2e, 0xc8, 0x0f, 0x93, 0xc0};
+  // ucomisd xmm0, xmm1; sete al; setnp cl; and al, cl
+  static constexpr std::uint8_t EQUAL[] = {0x66, 0x0f, 0x2e, 0xc1, 0x0f, 0x94, 0xc0, 0x0f, 0x9b, 0xc1, 0x20, 0xc8};
+  // ucomisd xmm0, xmm1; setne al; setp cl; or al, cl
+  static constexpr std::uint8_t NOT_EQUAL[] = {0x66, 0x0f, 0x2e, 0xc1, 0x0f, 0x95, 0xc0, 0x0f, 0x9a, 0xc1, 0x08, 0xc8};
+  // al = whether rax is nil or false:
+  // mov rcx, NIL; cmp rax, rcx; sete dl; mov rcx, FALSE; cmp rax, rcx; sete al; or al, dl
+  static constexpr std::uint8_t FALSEY[] = {
+    0x48, 0xb9, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfc, 0x7f, 0x48, 0x39, 0xc8, 0x0f, 0x94, 0xc2,
+    0x48, 0xb9, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfc, 0x7f, 0x48, 0x39, 0xc8, 0x0f, 0x94, 0xc0,
+    0x08, 0xd0,
+  };
+  // rax = al ? true : false:
+  // movzx eax, al; mov rcx, FALSE; or rax, rcx
+  static constexpr std::uint8_t BOX_BOOL[] = {0x0f, 0xb6, 0xc0, 0x48, 0xb9, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfc, 0x7f, 0x48, 0x09, 0xc8};
+
+  // mov rcx, NIL; cmp rax, rcx; je rel32
+  static constexpr std::uint8_t JUMP_IF_NIL[] = {0x48, 0xb9, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfc, 0x7f, 0x48, 0x39, 0xc8, 0x0f, 0x84};
+  // mov rcx, FALSE; cmp rax, rcx; je rel32
+  static constexpr std::uint8_t JUMP_IF_FALSE[] = {0x48, 0xb9, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfc, 0x7f, 0x48, 0x39, 0xc8, 0x0f, 0x84};
+  // mov eax, [rax]; test eax, eax; jnz rel32
+  static constexpr std::uint8_t EXIT_IF_SET[] = {0x8b, 0x00, 0x85, 0xc0, 0x0f, 0x85};
+
+  // mov rdi, r12; mov esi, imm32
+  static constexpr std::uint8_t HELPER_INDEX[] = {0x4c, 0x89, 0xe7, 0xbe};
+  // lea rdx, [rbx + disp32]
+  static constexpr std::uint8_t HELPER_SLOT[] = {0x48, 0x8d, 0x93};
+  // call rax; test al, al; jz rel32
+  static constexpr std::uint8_t CALL_HELPER[] = {0xff, 0xd0, 0x84, 0xc0, 0x0f, 0x84};
+
+  struct Assembler {
+    std::vector<std::uint8_t> code = {};
+    // rel32 holes to fill in once every instruction's address is known:
+    // (hole position, bytecode offset to jump to or to exit at).
+    std::vector<std::pair<std::size_t, std::size_t>> jumps = {};
+    std::vector<std::pair<std::size_t, std::size_t>> exits = {};
+
+    auto copy(std::span<const std::uint8_t> stencil) -> void {
+      code.insert(code.end(), stencil.begin(), stencil.end());
+    }
+
+    template<typename T>
+    auto patch(T value) -> void {
+      auto&& bytes = std::bit_cast<std::array<std::uint8_t, sizeof(T)>>(value);
+      code.insert(code.end(), bytes.begin(), bytes.end());
+    }
+
+    auto slot(std::size_t index) -> void {
+      patch(static_cast<std::uint32_t>(index * sizeof(Object)));
+    }
+
+    auto jumpTo(std::size_t offset) -> void {
+      jumps.emplace_back(code.size(), offset);
+      patch(std::uint32_t{});
+    }
+
+    auto exitAt(std::size_t offset) -> void {
+      exits.emplace_back(code.size(), offset);
+      patch(std::uint32_t{});
+    }
+
+    auto resolve(std::size_t hole, std::size_t target) -> void {
+      auto&& relative = static_cast<std::int32_t>(static_cast<std::int64_t>(target) - static_cast<std::int64_t>(hole + 4));
+      std::memcpy(code.data() + hole, &relative, sizeof relative);
+    }
+  };
+
+  // Length in bytes of the instruction at `offset`.
+  static auto length(const Chunk& chunk, std::size_t offset) -> std::size_t {
+    using enum OpCode;
+
+    switch (static_cast<OpCode>(chunk.code[offset])) {
+      case CONSTANT: case GET_GLOBAL: case DEFINE_GLOBAL: case SET_GLOBAL:
+      case JUMP: case JUMP_IF_FALSE: case LOOP:
+        return 3;
+      case GET_LOCAL: case SET_LOCAL: case GET_UPVALUE: case SET_UPVALUE: case CALL:
+        return 2;
+      case CLOSURE:
+        return 3 + 2 * chunk.functions[operand(chunk, offset)]->upvalueCount;
+      default:
+        return 1;
+    }
+  }
+
+  static auto operand(const Chunk& chunk, std::size_t offset) -> std::uint16_t {
+    return static_cast<std::uint16_t>((chunk.code[offset + 1] << 8) | chunk.code[offset + 2]);
+  }
+
+  // Stack depth before every reachable instruction, or nothing if some
+  // instruction can be reached with two different depths or the stack
+  // would outgrow the slots the Vm guarantees a frame. The code pushes
+  // without checking for room.
+  static auto depths(const VmFunction& function) -> std::optional<std::vector<int>> {
+    using enum OpCode;
+    using namespace std;
+
+    auto&& chunk = function.chunk;
+    auto&& result = vector<int>(chunk.code.size(), -1);
+    auto&& pending = vector<size_t>{0};
+    result[0] = static_cast<int>(function.arity) + 1;
+
+    auto&& reach = [&](size_t offset, int depth) {
+      if (offset >= chunk.code.size() || depth < 0) return false;
+      if (static_cast<size_t>(depth) > VmFunction::FRAME_SLOTS) return false;
+      if (result[offset] == -1) {
+        result[offset] = depth;
+        pending.push_back(offset);
+      }
+      return result[offset] == depth;
+    };
+
+    while (!pending.empty()) {
+      auto offset = pending.back();
+      pending.pop_back();
+
+      auto&& depth = result[offset];
+      auto&& next = offset + length(chunk, offset);
+      auto&& ok = true;
+      switch (static_cast<OpCode>(chunk.code[offset])) {
+        case CONSTANT: case NIL: case TRUE: case FALSE: case GET_LOCAL: case GET_GLOBAL: case GET_UPVALUE: case CLOSURE:
+          ok = reach(next, depth + 1);
+          break;
+        case POP: case DEFINE_GLOBAL: case PRINT: case CLOSE_UPVALUE:
+        case EQUAL: case NOT_EQUAL: case GREATER: case GREATER_EQUAL: case LESS: case LESS_EQUAL:
+        case ADD: case SUBTRACT: case MULTIPLY: case DIVIDE:
+          ok = reach(next, depth - 1);
+          break;
+        case SET_LOCAL: case SET_GLOBAL: case SET_UPVALUE: case NOT: case NEGATE:
+          ok = reach(next, depth);
+          break;
+        case JUMP:
+          ok = reach(next + operand(chunk, offset), depth);
+          break;
+        case JUMP_IF_FALSE:
+          ok = reach(next, depth) && reach(next + operand(chunk, offset), depth);
+          break;
+        case LOOP:
+          ok = next >= operand(chunk, offset) && reach(next - operand(chunk, offset), depth);
+          break;
+        case CALL:
+          ok = reach(next, depth - chunk.code[offset + 1]);
+          break;
+        case RETURN:
+          break;
+      }
+      if (!ok) return {};
+    }
+
+    return result;
+  }
+
+  static auto compile([[maybe_unused]] const VmFunction& function, [[maybe_unused]] const Helpers& helpers) -> std::shared_ptr<JitCode> {
+#if LOX_JIT
+    using enum OpCode;
+    using namespace std;
+
+    auto&& chunk = function.chunk;
+    auto&& depth = depths(function);
+    if (!depth) return {};
+
+    auto&& a = Assembler{};
+    a.copy(PROLOGUE);
+    a.patch(QNAN);
+    a.copy(LOAD_R14);
+    a.patch(HEAP_MASK);
+    a.copy(JUMP_RDX);
+
+    auto&& entries = vector<uint32_t>(chunk.code.size(), JitCode::NO_ENTRY);
+    for (size_t offset = 0; offset < chunk.code.size(); offset += length(chunk, offset)) {
+      auto&& d = static_cast<size_t>((*depth)[offset]);
+      if ((*depth)[offset] < 0) continue;
+      entries[offset] = static_cast<uint32_t>(a.code.size());
+
+      auto&& top = d - 1;
+      auto&& left = d - 2;
+      // Pushing overwrites the slot above the top, which may still hold a
+      // heap value the Vm left there; releasing it is left to the Vm.
+      auto&& push = [&] {
+        a.copy(LOAD_RCX);
+        a.slot(d);
+        a.copy(EXIT_IF_HEAP_RCX);
+        a.exitAt(offset);
+      };
+      auto&& store = [&](size_t slot) {
+        a.copy(STORE_RAX);
+        a.slot(slot);
+      };
+      auto&& operands = [&] {
+        a.copy(LOAD_RAX);
+        a.slot(left);
+        a.copy(LOAD_RCX);
+        a.slot(top);
+        a.copy(EXIT_UNLESS_NUMBER_RAX);
+        a.exitAt(offset);
+        a.copy(EXIT_UNLESS_NUMBER_RCX);
+        a.exitAt(offset);
+        a.copy(NUMBERS);
+      };
+      auto&& arithmetic = [&](span<const uint8_t> op) {
+        operands();
+        a.copy(op);
+        a.copy(BOX_NUMBER);
+        store(left);
+      };
+      auto&& comparison = [&](span<const uint8_t> op) {
+        operands();
+        a.copy(op);
+        a.copy(BOX_BOOL);
+        store(left);
+      };
+      auto&& constant = [&](const Object& value) {
+        push();
+        a.copy(MOVE_RAX);
+        a.patch(value.bits);
+        if (value.isHeap()) {
+          a.copy(MOVE_RDX);
+          a.patch(reinterpret_cast<uintptr_t>(value.heap()));
+          a.copy(RETAIN_RDX);
+        }
+        store(d);
+      };
+      auto&& helper = [&](Helpers::Global call, size_t slot) {
+        a.copy(HELPER_INDEX);
+        a.patch(static_cast<uint32_t>(operand(chunk, offset)));
+        a.copy(HELPER_SLOT);
+        a.slot(slot);
+        a.copy(MOVE_RAX);
+        a.patch(reinterpret_cast<uintptr_t>(call));
+        a.copy(CALL_HELPER);
+        a.exitAt(offset);
+      };
+      auto&& leave = [&] {
+        a.copy(Jit::JUMP);
+        a.exitAt(offset);
+      };
+
+      switch (static_cast<OpCode>(chunk.code[offset])) {
+        case CONSTANT: constant(chunk.constants[operand(chunk, offset)]); break;
+        case NIL: constant(Object{}); break;
+        case TRUE: constant(Object{true}); break;
+        case FALSE: constant(Object{false}); break;
+        case POP:
+          a.copy(LOAD_RAX);
+          a.slot(top);
+          a.copy(EXIT_IF_HEAP_RAX);
+          a.exitAt(offset);
+          break;
+        case GET_LOCAL:
+          push();
+          a.copy(LOAD_RAX);
+          a.slot(chunk.code[offset + 1]);
+          a.copy(RETAIN_RAX);
+          store(d);
+          break;
+        case SET_LOCAL:
+          // The old value must not need releasing.
+          a.copy(LOAD_RCX);
+          a.slot(chunk.code[offset + 1]);
+          a.copy(EXIT_IF_HEAP_RCX);
+          a.exitAt(offset);
+          a.copy(LOAD_RAX);
+          a.slot(top);
+          a.copy(RETAIN_RAX);
+          store(chunk.code[offset + 1]);
+          break;
+        case GET_GLOBAL: helper(helpers.getGlobal, d); break;
+        case SET_GLOBAL: helper(helpers.setGlobal, top); break;
+        case EQUAL: comparison(Jit::EQUAL); break;
+        case NOT_EQUAL: comparison(Jit::NOT_EQUAL); break;
+        case GREATER: comparison(Jit::GREATER); break;
+        case GREATER_EQUAL: comparison(Jit::GREATER_EQUAL); break;
+        case LESS: comparison(Jit::LESS); break;
+        case LESS_EQUAL: comparison(Jit::LESS_EQUAL); break;
+        case ADD: arithmetic(Jit::ADD); break;
+        case SUBTRACT: arithmetic(Jit::SUBTRACT); break;
+        case MULTIPLY: arithmetic(Jit::MULTIPLY); break;
+        case DIVIDE: arithmetic(Jit::DIVIDE); break;
+        case NOT:
+          a.copy(LOAD_RAX);
+          a.slot(top);
+          a.copy(EXIT_IF_HEAP_RAX);
+          a.exitAt(offset);
+          a.copy(FALSEY);
+          a.copy(BOX_BOOL);
+          store(top);
+          break;
+        case NEGATE:
+          a.copy(LOAD_RAX);
+          a.slot(top);
+          a.copy(EXIT_UNLESS_NUMBER_RAX);
+          a.exitAt(offset);
+          a.copy(Jit::NEGATE);
+          a.copy(BOX_NUMBER);
+          store(top);
+          break;
+        case JUMP:
+          a.copy(Jit::JUMP);
+          a.jumpTo(offset + 3 + operand(chunk, offset));
+          break;
+        case JUMP_IF_FALSE:
+          a.copy(LOAD_RAX);
+          a.slot(top);
+          a.copy(JUMP_IF_NIL);
+          a.jumpTo(offset + 3 + operand(chunk, offset));
+          a.copy(Jit::JUMP_IF_FALSE);
+          a.jumpTo(offset + 3 + operand(chunk, offset));
+          break;
+        case LOOP:
+          // A pending profiler tick is taken by the Vm, which samples on
+          // back-edges.
+          a.copy(MOVE_RAX);
+          a.patch(reinterpret_cast<uintptr_t>(&Profiler::pending));
+          a.copy(EXIT_IF_SET);
+          a.exitAt(offset);
+          a.copy(Jit::JUMP);
+          a.jumpTo(offset + 3 - operand(chunk, offset));
+          break;
+        default:
+          leave();
+          break;
+      }
+    }
+
+    // Exit stubs, one per instruction that has a way out, then the
+    // epilogue they all jump to.
+    auto&& stubs = vector<uint32_t>(chunk.code.size(), JitCode::NO_ENTRY);
+    auto&& stubJumps = vector<size_t>{};
+    for (auto&& [hole, offset]: a.exits) {
+      if (stubs[offset] == JitCode::NO_ENTRY) {
+        stubs[offset] = static_cast<uint32_t>(a.code.size());
+        a.copy(SET_EAX);
+        a.patch(static_cast<uint32_t>(offset));
+        a.copy(Jit::JUMP);
+        stubJumps.push_back(a.code.size());
+        a.patch(uint32_t{});
+      }
+    }
+    auto&& epilogue = a.code.size();
+    a.copy(EPILOGUE);
+
+    for (auto&& [hole, offset]: a.exits) a.resolve(hole, stubs[offset]);
+    for (auto&& hole: stubJumps) a.resolve(hole, epilogue);
+    for (auto&& [hole, offset]: a.jumps) {
+      if (entries[offset] == JitCode::NO_ENTRY) return {};
+      a.resolve(hole, entries[offset]);
+    }
+
+    auto&& pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    auto&& size = (a.code.size() + pageSize - 1) / pageSize * pageSize;
+    auto* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return {};
+
+    std::memcpy(memory, a.code.data(), a.code.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(memory, size);
+      return {};
+    }
+
+    auto&& stackDepths = vector<uint16_t>(chunk.code.size());
+    for (size_t offset = 0; offset < chunk.code.size(); offset++) {
+      stackDepths[offset] = static_cast<uint16_t>(max((*depth)[offset], 0));
+    }
+    return make_shared<JitCode>(memory, size, std::move(entries), std::move(stackDepths));
+#else
+    return {};
+#endif
+  }
+};
+}
@@ -1,67 +1,43 @@
-#include "Interpreter.hpp"
+#include "Batch.hpp"
+#include "CppEmitter.hpp"
+#include "Diagnostics.hpp"
+#include "Jit.hpp"
 #include "Lox.hpp"
+#include "Optimizer.hpp"
 #include "Parser.hpp"
-#include "RuntimeError.hpp"
+#include "Resolver.hpp"
 #include "Scanner.hpp"
-#include "TokenType.hpp"
+#include "Session.hpp"
+#include "SourceFile.hpp"
+#include "Symbol.hpp"
 
 #include <fmt/core.h>
 
+#include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <string>
 
 namespace lox {
-auto report(std::size_t line, const std::string& where, const std::string& message) -> void {
-  using namespace fmt;
-
-  print("[line {}] Error {}: {}\n", line, where, message);
-  hadError = true;
-}
-
-auto error(const Token& token, const std::string& message) -> void {
-  using enum TokenType;
-
-  if (token.type == LOX_EOF) {
-    report(token.line, " at end", message);
-  } else {
-    report(token.line, " at '" + token.lexeme + "'", message);
-  }
-}
-
-auto error(std::size_t line, const std::string& message) -> void {
-  report(line, "", message);
+auto jitSupported() -> bool {
+  return Jit::SUPPORTED;
 }
 
-auto runtimeError(const RuntimeError& error) -> void {
-  using namespace fmt;
-
-  print("{} \n[line {} ]", error.what(), error.token.line);
-  hadRuntimeError = true;
+auto run(std::string_view source, const Options& options) -> void {
+  Session{options}.run(source, Session::Lifetime::SESSION);
 }
 
-auto run(const std::string& source) -> void {
-  using namespace fmt;
-
-  auto&& scanner = Scanner{source};
-  auto&& tokens = scanner.scanTokens();
-  auto&& parser = Parser{tokens};
-  auto&& statements = parser.parse();
-
-  if (hadError) return;
-
-  print("{}\n", statements);
-
-  auto&& interpreter = Interpreter{};
-  interpreter.interpret(statements);
-}
-
-auto runPrompt() -> void {
+auto runPrompt(const Options& options) -> void {
   using namespace fmt;
   using namespace std;
 
+  // Lines typed at the prompt are not worth a cache entry each.
+  auto lineOptions = options;
+  lineOptions.cache.clear();
+
+  // Every line runs in the same Session, so later lines see earlier globals.
+  auto&& session = Session{lineOptions};
   for (;;) {
     print("> ");
 
@@ -69,28 +45,77 @@ auto runPrompt() -> void {
     getline(cin, line);
     if (empty(line)) break;
 
-    run(line);
-    if (hadError) {
+    if (session.run(line) == Session::Result::STATIC_ERROR) {
       exit(65);
     }
   }
 }
 
-auto runFile(char* path) -> void {
+auto runFile(char* path, const Options& options) -> void {
+  using enum Session::Result;
   using namespace std;
 
-  auto&& fs = ifstream{};
-  fs.open(path, ios::in);
-  if (!fs.is_open()) {
+  auto&& source = SourceFile::open(path);
+  if (!source) {
     return;
   }
 
-  auto&& strStream = stringstream{};
-  strStream << fs.rdbuf();
-  auto&& source = strStream.str();
+  auto&& result = Session{options}.run(source->view(), Session::Lifetime::SESSION);
+  if (result == STATIC_ERROR) exit(65);
+  if (result == RUNTIME_ERROR) exit(70);
+}
+
+auto emitCpp(char* path, const Options& options) -> void {
+  using namespace fmt;
+  using namespace std;
+
+  auto&& source = SourceFile::open(path);
+  if (!source) {
+    return;
+  }
+
+  // Static errors are reported exactly as runFile reports them.
+  auto&& diagnostics = Diagnostics{};
+  auto&& symbols = SymbolTable{};
+  auto&& tokens = Scanner{source->view(), symbols, diagnostics}.scanTokens();
+  auto&& tree = Parser{diagnostics, tokens}.parse();
+  if (!diagnostics.hadError) Resolver{diagnostics}.resolve(tree.statements);
+  if (diagnostics.hadError) exit(65);
+
+  if (options.optimize) Optimizer{*tree.arena}.optimize(tree.statements);
+  auto&& code = CppEmitter::emit(tree.statements, path);
+
+  if (options.emitCpp == "-") {
+    fwrite(code.data(), 1, code.size(), stdout);
+    return;
+  }
+  auto&& file = ofstream{options.emitCpp, ios::binary};
+  if (!(file << code)) {
+    print(stderr, "Could not write '{}'.\n", options.emitCpp);
+    exit(74);
+  }
+}
+
+auto runBatch(const std::string& path, const Options& options) -> void {
+  using namespace fmt;
+  using namespace std;
+
+  auto&& batch = Batch::open(path);
+  if (!batch) {
+    print(stderr, "Could not read batch '{}'.\n", path);
+    exit(66);
+  }
 
-  run(source);
-  if (hadError) exit(65);
-  if (hadRuntimeError) exit(70);
+  // The profiler is process-wide and per-run reports would interleave on
+  // stderr, so scripts run without them; the batch prints its own summary.
+  auto scriptOptions = options;
+  scriptOptions.stats = false;
+  scriptOptions.perfCounters = false;
+  scriptOptions.profile.clear();
+
+  batch->run(scriptOptions, ThreadPool{});
+  batch->print();
+  batch->report();
+  exit(batch->status());
 }
 }
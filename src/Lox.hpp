@@ -1,26 +1,54 @@
 #pragma once
 
-#include "RuntimeError.hpp"
-#include "TokenType.hpp"
-
-#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace lox {
-static bool hadError = false;
-static bool hadRuntimeError = false;
-
-auto report(std::size_t line, const std::string& where, const std::string& message) -> void;
-
-auto error(const Token& token, const std::string& message) -> void;
-
-auto error(std::size_t line, const std::string& message) -> void;
-
-auto runtimeError(const RuntimeError& error) -> void;
-
-auto run(const std::string& source) -> void;
-
-auto runPrompt() -> void;
-
-auto runFile(char* path) -> void;
+enum class Engine: std::uint8_t {
+  TREE,
+  VM,
+  // The tree walker's runtime driving closures compiled from the tree.
+  CLOSURE,
+};
+
+struct Options {
+  Engine engine = Engine::TREE;
+  // Scan, parse and execute one top-level declaration at a time instead of
+  // materializing every token and the whole syntax tree up front.
+  bool stream = false;
+  // Fold constants and prune dead branches before executing.
+  bool optimize = true;
+  // Print per-phase timings and execution counters to stderr after the run.
+  bool stats = false;
+  // Attribute hardware performance counters to each phase in that report.
+  bool perfCounters = false;
+  // When set, sample the running program and write folded stacks to this
+  // path; the per-line hit table goes to stderr.
+  std::string profile = {};
+  // When set, resolved syntax trees of scripts are cached in this directory
+  // and reused by later runs of the same source.
+  std::string cache = {};
+  // When set, the script is translated into a C++ program at this path
+  // (see CppEmitter) instead of being run.
+  std::string emitCpp = {};
+  // Compile hot bytecode functions to machine code (Engine::VM only).
+  bool jit = false;
+};
+
+// Whether this build can honour Options::jit: it needs x86-64 Linux and the
+// NaN-boxed value layout.
+auto jitSupported() -> bool;
+
+auto run(std::string_view source, const Options& options = {}) -> void;
+
+auto runPrompt(const Options& options = {}) -> void;
+
+auto runFile(char* path, const Options& options = {}) -> void;
+
+// Translates the script at `path` to C++ as Options::emitCpp asks ("-"
+// for stdout).
+auto emitCpp(char* path, const Options& options = {}) -> void;
+
+auto runBatch(const std::string& path, const Options& options = {}) -> void;
 }
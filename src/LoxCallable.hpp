@@ -1,23 +1,52 @@
 #pragma once
 
-namespace lox {
-struct Interpreter;
-}
-
-#include "Interpreter.hpp"
+#include "HeapObject.hpp"
 #include "Object.hpp"
 
-#include <vector>
+#include <cstddef>
+#include <span>
+#include <string>
 
 namespace lox {
-struct LoxCallable {
+struct Interpreter;
+
+// Reference counted through its HeapObject header and freed through the
+// virtual destructor, so callables are created with Ref<T>::make().
+struct LoxCallable: HeapObject {
+  LoxCallable():
+    HeapObject(Kind::CALLABLE, &destroyAs<LoxCallable>)
+  {}
+
   virtual
   ~LoxCallable() = 0;
 
   virtual
-  auto arity() -> size_t = 0;
+  auto arity() -> std::size_t = 0;
+
+  // `arguments` views the Interpreter's argument stack. The callee may move
+  // out of it, but must be done with it before evaluating anything itself.
+  virtual
+  auto call(Interpreter& interpreter, std::span<Object> arguments) -> Object = 0;
 
   virtual
-  auto call(Interpreter& interpreter, std::vector<Object>&& arguments) -> Object = 0;
+  auto name() const -> std::string = 0;
 };
-}
\ No newline at end of file
+
+inline LoxCallable::~LoxCallable() = default;
+
+inline auto to_string(const LoxCallable& callable) -> std::string {
+  return "<fn " + callable.name() + ">";
+}
+
+#if LOX_NAN_BOXING
+// Callables are only boxed from a Ref<LoxCallable> or a subtype, so the
+// object itself is never const.
+inline auto asCallable(const Object& object) -> LoxCallable& {
+  return const_cast<LoxCallable&>(static_cast<const LoxCallable&>(*object.heap()));
+}
+#else
+inline auto asCallable(const Object& object) -> LoxCallable& {
+  return *unchecked<Ref<LoxCallable>>(object);
+}
+#endif
+}
@@ -2,36 +2,36 @@
 
 #include "Ast.hpp"
 #include "Environment.hpp"
-#include "Interpreter.hpp"
 #include "LoxCallable.hpp"
 #include "Object.hpp"
-#include "Return.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
 
 namespace lox {
 struct LoxFunction: public LoxCallable {
   Function* declaration;
   std::shared_ptr<Environment> closure;
 
+  LoxFunction(Function* declaration, std::shared_ptr<Environment> closure):
+    declaration(declaration),
+    closure(std::move(closure))
+  {}
+
   ~LoxFunction() override = default;
 
-  auto arity() -> size_t override {
+  auto arity() -> std::size_t override {
     return declaration->params.size();
   }
 
-  auto call(Interpreter& interpreter, std::vector<Object>&& arguments) -> Object override {
-    using namespace std;
-    
-    auto&& environment = make_shared<Environment>(closure);
-    for (size_t i = 0; i < declaration->params.size(); i++) {
-      environment->define(declaration->params[i].lexeme, std::move(arguments[i]));
-    }
-
-    try {
-      interpreter.executeBlock(declaration->body, environment);
-    } catch (const ReturnException& returnValue) {
-      return returnValue.value;
-    }
-    return {};
+  // Defined in Interpreter.hpp, which needs the complete LoxFunction type.
+  auto call(Interpreter& interpreter, std::span<Object> arguments) -> Object override;
+
+  auto name() const -> std::string override {
+    return std::string{declaration->name.lexeme};
   }
 };
-}
\ No newline at end of file
+}
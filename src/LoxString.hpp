@@ -0,0 +1,152 @@
+#pragma once
+
+#include "HeapObject.hpp"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lox {
+// Runtime string value. Strings are immutable and shared by reference, so
+// copying one between variables, slots and the VM stack only bumps the count
+// in its HeapObject header.
+//
+// Concatenation does not copy its operands: it builds a rope node that
+// refers to both, and the characters are only gathered when something needs
+// them (printing, comparing). Appending a short string to a rope whose
+// rightmost piece is also short copies just that piece, which keeps loops
+// that grow a string one fragment at a time from building a node per
+// fragment.
+//
+// Equal strings can be told apart by address after interning: the first
+// string with a given content to be compared becomes the canonical one and
+// later ones remember it. The intern table is per thread, like the values
+// themselves, and strings must not outlive the thread that made them.
+struct LoxString: HeapObject {
+  // Concatenations up to this many characters are copied flat.
+  static constexpr std::size_t FLAT_MAX = 256;
+
+  // The characters, once flattened; empty while `left` is set.
+  mutable std::string value;
+  mutable Ref<const LoxString> left = {};
+  mutable Ref<const LoxString> right = {};
+  std::size_t length = {};
+  // The interned string with the same content, once it has been looked up.
+  mutable Ref<const LoxString> canonical = {};
+  mutable bool interned = {};
+
+  explicit LoxString(std::string value):
+    HeapObject(Kind::STRING, &destroyAs<LoxString>),
+    value(std::move(value)),
+    length(this->value.size())
+  {}
+
+  LoxString(Ref<const LoxString> left, Ref<const LoxString> right):
+    HeapObject(Kind::STRING, &destroyAs<LoxString>),
+    left(std::move(left)),
+    right(std::move(right)),
+    length(this->left->length + this->right->length)
+  {}
+
+  ~LoxString() {
+    if (interned) table().erase(value);
+    release(std::move(left));
+    release(std::move(right));
+  }
+
+  static auto make(std::string value) -> Ref<const LoxString> {
+    return Ref<const LoxString>::make(std::move(value));
+  }
+
+  static auto concat(const LoxString& left, const LoxString& right) -> Ref<const LoxString> {
+    if (left.length == 0) return Ref{&right};
+    if (right.length == 0) return Ref{&left};
+
+    if (left.length + right.length <= FLAT_MAX) return make(left.str() + right.str());
+
+    // Fold a short right operand into the rope's short last piece.
+    if (left.left && !left.right->left && left.right->length + right.length <= FLAT_MAX) {
+      return Ref<const LoxString>::make(left.left, make(left.right->value + right.str()));
+    }
+
+    return Ref<const LoxString>::make(Ref{&left}, Ref{&right});
+  }
+
+  // The characters, flattening the rope on first use.
+  auto str() const -> const std::string& {
+    if (left) flatten();
+    return value;
+  }
+
+  static auto equal(const LoxString& a, const LoxString& b) -> bool {
+    if (&a == &b) return true;
+    if (a.length != b.length) return false;
+    return a.identity() == b.identity();
+  }
+
+  // The canonical string with this content.
+  auto identity() const -> const LoxString* {
+    if (interned) return this;
+    if (canonical) return canonical.get();
+
+    auto&& [it, inserted] = table().try_emplace(std::string_view{str()}, this);
+    if (inserted) {
+      interned = true;
+      return this;
+    }
+
+    canonical = Ref{it->second};
+    return canonical.get();
+  }
+
+  auto flatten() const -> void {
+    value.reserve(length);
+
+    // Ropes built in a loop are as deep as the loop ran long, so walk them
+    // with an explicit stack.
+    auto&& pending = std::vector<const LoxString*>{right.get(), left.get()};
+    while (!pending.empty()) {
+      auto* node = pending.back();
+      pending.pop_back();
+
+      if (node->left) {
+        pending.push_back(node->right.get());
+        pending.push_back(node->left.get());
+      } else {
+        value += node->value;
+      }
+    }
+
+    release(std::move(left));
+    release(std::move(right));
+  }
+
+  // Drops a reference to a rope without recursing once per level.
+  static auto release(Ref<const LoxString>&& node) -> void {
+    if (!node) return;
+    if (node.use_count() > 1 || !node->left) {
+      node.reset();
+      return;
+    }
+
+    auto&& pending = std::vector<Ref<const LoxString>>{};
+    pending.push_back(std::move(node));
+    while (!pending.empty()) {
+      auto last = std::move(pending.back());
+      pending.pop_back();
+      if (!last || last.use_count() > 1) continue;
+
+      pending.push_back(std::move(last->left));
+      pending.push_back(std::move(last->right));
+    }
+  }
+
+  static auto table() -> std::unordered_map<std::string_view, const LoxString*>& {
+    thread_local std::unordered_map<std::string_view, const LoxString*> strings;
+    return strings;
+  }
+};
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "HeapObject.hpp"
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace lox {
+// 64-bit value representation. Doubles are stored as themselves; everything
+// else lives in the payload of a quiet NaN. nil and booleans are small tags,
+// heap objects (strings and callables) are pointers to their HeapObject
+// header with the sign bit set. The box holds one of the object's references.
+struct NanBoxed {
+  static constexpr std::uint64_t SIGN_BIT = 0x8000'0000'0000'0000;
+  static constexpr std::uint64_t QNAN = 0x7ffc'0000'0000'0000;
+  static constexpr std::uint64_t CANONICAL_NAN = 0x7ff8'0000'0000'0000;
+  static constexpr std::uint64_t TAG_NIL = 1;
+  static constexpr std::uint64_t TAG_FALSE = 2;
+  static constexpr std::uint64_t TAG_TRUE = 3;
+  static constexpr std::uint64_t NIL_BITS = QNAN | TAG_NIL;
+  static constexpr std::uint64_t FALSE_BITS = QNAN | TAG_FALSE;
+  static constexpr std::uint64_t TRUE_BITS = QNAN | TAG_TRUE;
+
+  std::uint64_t bits = NIL_BITS;
+
+  NanBoxed() = default;
+
+  NanBoxed(std::monostate) {}
+
+  NanBoxed(bool value):
+    bits(value ? TRUE_BITS : FALSE_BITS)
+  {}
+
+  NanBoxed(double value):
+    // Collapse NaNs produced by arithmetic so they can never alias a tag.
+    bits(std::isnan(value) ? CANONICAL_NAN : std::bit_cast<std::uint64_t>(value))
+  {}
+
+  // Takes over the reference `value` held. A template, since callables are
+  // still incomplete where values are defined.
+  template<typename T>
+    requires std::is_base_of_v<HeapObject, T>
+  NanBoxed(Ref<T> value):
+    bits(SIGN_BIT | QNAN | reinterpret_cast<std::uintptr_t>(static_cast<const HeapObject*>(std::exchange(value.object, nullptr))))
+  {}
+
+  NanBoxed(const NanBoxed& other):
+    bits(other.bits)
+  {
+    if (isHeap()) heap()->retain();
+  }
+
+  NanBoxed(NanBoxed&& other) noexcept:
+    bits(std::exchange(other.bits, NIL_BITS))
+  {}
+
+  auto operator=(const NanBoxed& other) -> NanBoxed& {
+    if (other.isHeap()) other.heap()->retain();
+    release();
+    bits = other.bits;
+    return *this;
+  }
+
+  auto operator=(NanBoxed&& other) noexcept -> NanBoxed& {
+    if (this != &other) {
+      release();
+      bits = std::exchange(other.bits, NIL_BITS);
+    }
+    return *this;
+  }
+
+  ~NanBoxed() {
+    release();
+  }
+
+  auto isNumber() const -> bool {
+    return (bits & QNAN) != QNAN;
+  }
+
+  auto isNil() const -> bool {
+    return bits == NIL_BITS;
+  }
+
+  auto isBool() const -> bool {
+    return (bits | 1) == TRUE_BITS;
+  }
+
+  auto isHeap() const -> bool {
+    return (bits & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN);
+  }
+
+  auto isHeap(HeapObject::Kind kind) const -> bool {
+    return isHeap() && heap()->kind == kind;
+  }
+
+  auto asNumber() const -> double {
+    return std::bit_cast<double>(bits);
+  }
+
+  auto asBool() const -> bool {
+    return bits == TRUE_BITS;
+  }
+
+  auto heap() const -> const HeapObject* {
+    return reinterpret_cast<const HeapObject*>(static_cast<std::uintptr_t>(bits & ~(SIGN_BIT | QNAN)));
+  }
+
+  auto release() -> void {
+    if (isHeap()) heap()->release();
+  }
+};
+
+static_assert(sizeof(NanBoxed) == sizeof(std::uint64_t));
+}
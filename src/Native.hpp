@@ -0,0 +1,211 @@
+#pragma once
+
+#include "LoxCallable.hpp"
+#include "LoxString.hpp"
+#include "Object.hpp"
+#include "RuntimeError.hpp"
+
+#include <fmt/format.h>
+
+#include <cmath>
+#include <cstddef>
+#include <exception>
+#include <expected>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace lox {
+// A C++ function exposed to Lox. Native::bind() generates an adapter for
+// the function's exact signature that checks and converts every argument
+// straight out of the caller's span (the Interpreter's argument stack or the
+// Vm's value stack), calls the function and boxes its result. Both engines
+// recognize natives and call invoke() themselves, so a call costs the arity
+// check, one indirect call and the conversions.
+//
+// Parameters may be arithmetic types (taking a number, converted as by
+// static_cast), bool, std::string or std::string_view (taking a string) and
+// Object (taking anything). An integer parameter only takes numbers whose
+// integer part it can hold; anything else, NaN and infinities included, is
+// a runtime error rather than an undefined conversion. Results may be any
+// of those, a const char* or void, which returns nil. Exceptions the
+// function throws become runtime errors too.
+struct Native final: public LoxCallable {
+  // The result, or the message of the runtime error to raise.
+  using Result = std::expected<Object, std::string>;
+  using Adapter = auto (*)(const void* function, std::span<Object> arguments, std::string_view name) -> Result;
+
+  std::string identifier;
+  std::size_t parameters = {};
+  // The bound callable; only `adapter` knows its type.
+  std::shared_ptr<const void> function;
+  Adapter adapter = {};
+
+  Native(std::string identifier, std::size_t parameters, std::shared_ptr<const void> function, Adapter adapter):
+    identifier(std::move(identifier)),
+    parameters(parameters),
+    function(std::move(function)),
+    adapter(adapter)
+  {}
+
+  ~Native() override = default;
+
+  // Parameter and result types of a function pointer or of a lambda or
+  // other object with a single, const call operator.
+  template<typename F>
+  struct Signature: Signature<decltype(&F::operator())> {};
+
+  template<typename R, typename... A>
+  struct Signature<R (*)(A...)> {
+    template<typename F>
+    static auto adapter() -> Adapter {
+      return [](const void* function, std::span<Object> arguments, std::string_view name) -> Result {
+        return adapt<F, R, A...>(*static_cast<const F*>(function), arguments, name, std::index_sequence_for<A...>{});
+      };
+    }
+
+    static constexpr std::size_t arity = sizeof...(A);
+  };
+
+  template<typename R, typename... A>
+  struct Signature<R (*)(A...) noexcept>: Signature<R (*)(A...)> {};
+
+  template<typename C, typename R, typename... A>
+  struct Signature<R (C::*)(A...) const>: Signature<R (*)(A...)> {};
+
+  template<typename C, typename R, typename... A>
+  struct Signature<R (C::*)(A...) const noexcept>: Signature<R (*)(A...)> {};
+
+  template<typename F>
+  static auto bind(std::string name, F function) -> Ref<Native> {
+    using Bound = Signature<F>;
+
+    return Ref<Native>::make(
+      std::move(name),
+      Bound::arity,
+      std::make_shared<const F>(std::move(function)),
+      Bound::template adapter<F>()
+    );
+  }
+
+  auto invoke(std::span<Object> arguments) const -> Result {
+    try {
+      return adapter(function.get(), arguments, identifier);
+    } catch (const RuntimeError&) {
+      // Already a Lox error with its own line, as raised by the functions
+      // of programs translated by --emit-cpp.
+      throw;
+    } catch (const std::exception& error) {
+      return std::unexpected{fmt::format("Error in '{}': {}", identifier, error.what())};
+    } catch (...) {
+      return std::unexpected{fmt::format("Error in '{}'.", identifier)};
+    }
+  }
+
+  auto arity() -> std::size_t override {
+    return parameters;
+  }
+
+  auto call(Interpreter&, std::span<Object>) -> Object override {
+    throw std::logic_error{"Natives are called through Native::invoke."};
+  }
+
+  auto name() const -> std::string override {
+    return identifier;
+  }
+
+  template<typename F, typename R, typename... A, std::size_t... I>
+  static auto adapt(const F& function, [[maybe_unused]] std::span<Object> arguments, [[maybe_unused]] std::string_view name, std::index_sequence<I...>) -> Result {
+    // Stops at the first argument that does not convert.
+    auto&& mismatch = std::optional<std::string>{};
+    static_cast<void>(((mismatch = argumentError<A>(arguments[I], I, name), !mismatch) && ...));
+    if (mismatch) return std::unexpected{std::move(*mismatch)};
+
+    if constexpr (std::is_void_v<R>) {
+      std::invoke(function, unbox<A>(arguments[I])...);
+      return Object{};
+    } else {
+      return box(std::invoke(function, unbox<A>(arguments[I])...));
+    }
+  }
+
+  // Why `value` cannot be passed as parameter `index` of type T, if it
+  // cannot.
+  template<typename T>
+  static auto argumentError(const Object& value, std::size_t index, std::string_view name) -> std::optional<std::string> {
+    using U = std::remove_cvref_t<T>;
+
+    auto&& error = [&](std::string_view kind) {
+      return std::optional{fmt::format("Argument {} to '{}' must be {}.", index + 1, name, kind)};
+    };
+
+    if constexpr (std::is_same_v<U, Object>) {
+      return {};
+    } else if constexpr (std::is_same_v<U, bool>) {
+      if (!isBool(value)) return error("a boolean");
+      return {};
+    } else if constexpr (std::is_integral_v<U>) {
+      if (!isNumber(value)) return error("a number");
+      if (!fits<U>(asNumber(value))) {
+        return error(fmt::format("a number from {} to {}", std::numeric_limits<U>::min(), std::numeric_limits<U>::max()));
+      }
+      return {};
+    } else if constexpr (std::is_arithmetic_v<U>) {
+      if (!isNumber(value)) return error("a number");
+      return {};
+    } else {
+      static_assert(std::is_same_v<U, std::string> || std::is_same_v<U, std::string_view>, "Unsupported native parameter type.");
+      if (!isString(value)) return error("a string");
+      return {};
+    }
+  }
+
+  // Whether converting `number` to the integer type U is defined: its
+  // integer part must be in U's range. The bounds min and max + 1 are zero
+  // or powers of two and come out exact in double, even where max alone
+  // would round.
+  template<typename U>
+  static auto fits(double number) -> bool {
+    auto&& whole = std::trunc(number);
+    return whole >= static_cast<double>(std::numeric_limits<U>::min())
+      && whole < static_cast<double>(std::numeric_limits<U>::max()) + 1.0;
+  }
+
+  template<typename T>
+  static auto unbox(const Object& value) -> decltype(auto) {
+    using U = std::remove_cvref_t<T>;
+
+    if constexpr (std::is_same_v<U, Object>) {
+      return (value);
+    } else if constexpr (std::is_same_v<U, bool>) {
+      return asBool(value);
+    } else if constexpr (std::is_arithmetic_v<U>) {
+      return static_cast<U>(asNumber(value));
+    } else {
+      return (asString(value));
+    }
+  }
+
+  template<typename T>
+  static auto box(T&& value) -> Object {
+    using U = std::remove_cvref_t<T>;
+
+    if constexpr (std::is_same_v<U, Object>) {
+      return std::forward<T>(value);
+    } else if constexpr (std::is_same_v<U, bool>) {
+      return Object{value};
+    } else if constexpr (std::is_arithmetic_v<U>) {
+      return Object{static_cast<double>(value)};
+    } else {
+      return Object{LoxString::make(std::string{std::forward<T>(value)})};
+    }
+  }
+};
+}
@@ -1,18 +1,107 @@
 #pragma once
 
-#include <boost/hana/functional/overload.hpp>
+#include "HeapObject.hpp"
+#include "LoxString.hpp"
+#include "NanBox.hpp"
+
 #include <fmt/format.h>
 
+#include <functional>
 #include <string>
+#include <utility>
 #include <variant>
 
+// Selects the runtime value layout: 0 for the std::variant below, 1 for the
+// 64-bit NanBoxed representation. Set through the LOX_NAN_BOXING CMake option.
+#ifndef LOX_NAN_BOXING
+#define LOX_NAN_BOXING 0
+#endif
+
 namespace lox {
+struct LoxCallable;
+
+#if LOX_NAN_BOXING
+using Object = NanBoxed;
+#else
 using Object = std::variant<
   std::monostate,
   double,
-  std::string,
-  bool
+  Ref<const LoxString>,
+  bool,
+  Ref<LoxCallable>
 >;
+#endif
+
+auto to_string(const LoxCallable& callable) -> std::string;
+
+// Representation-independent accessors. The as*() functions assume the
+// matching is*() check has already been made. asCallable() is defined in
+// LoxCallable.hpp, which has the complete type.
+inline auto asCallable(const Object& object) -> LoxCallable&;
+
+#if LOX_NAN_BOXING
+inline auto isNil(const Object& object) -> bool { return object.isNil(); }
+inline auto isBool(const Object& object) -> bool { return object.isBool(); }
+inline auto isNumber(const Object& object) -> bool { return object.isNumber(); }
+inline auto isString(const Object& object) -> bool { return object.isHeap(HeapObject::Kind::STRING); }
+inline auto isCallable(const Object& object) -> bool { return object.isHeap(HeapObject::Kind::CALLABLE); }
+
+inline auto asBool(const Object& object) -> bool { return object.asBool(); }
+inline auto asNumber(const Object& object) -> double { return object.asNumber(); }
+
+inline auto asLoxString(const Object& object) -> const LoxString& {
+  return static_cast<const LoxString&>(*object.heap());
+}
+
+inline auto isEqual(const Object& left, const Object& right) -> bool {
+  if (left.isNumber() && right.isNumber()) {
+    return std::equal_to<double>{}(left.asNumber(), right.asNumber());
+  }
+  if (isString(left) && isString(right)) return LoxString::equal(asLoxString(left), asLoxString(right));
+
+  // The same tag, or the same callable.
+  return left.bits == right.bits;
+}
+#else
+// The alternative `T` of `object`, which the caller has checked it holds.
+template<typename T>
+inline auto unchecked(const Object& object) -> const T& {
+  auto* value = std::get_if<T>(&object);
+  if (!value) std::unreachable();
+  return *value;
+}
+
+inline auto isNil(const Object& object) -> bool { return std::holds_alternative<std::monostate>(object); }
+inline auto isBool(const Object& object) -> bool { return std::holds_alternative<bool>(object); }
+inline auto isNumber(const Object& object) -> bool { return std::holds_alternative<double>(object); }
+inline auto isString(const Object& object) -> bool { return std::holds_alternative<Ref<const LoxString>>(object); }
+inline auto isCallable(const Object& object) -> bool { return std::holds_alternative<Ref<LoxCallable>>(object); }
+
+inline auto asBool(const Object& object) -> bool { return unchecked<bool>(object); }
+inline auto asNumber(const Object& object) -> double { return unchecked<double>(object); }
+
+inline auto asLoxString(const Object& object) -> const LoxString& {
+  return *unchecked<Ref<const LoxString>>(object);
+}
+
+inline auto isEqual(const Object& left, const Object& right) -> bool {
+  if (isString(left) && isString(right)) return LoxString::equal(asLoxString(left), asLoxString(right));
+
+  // Different alternatives never compare equal; NaN != NaN as in IEEE.
+  return left == right;
+}
+#endif
+
+// The characters of a string value; flattens it if it is still a rope.
+inline auto asString(const Object& object) -> const std::string& {
+  return asLoxString(object).str();
+}
+
+inline auto isTruthy(const Object& object) -> bool {
+  if (isNil(object)) return false;
+  if (isBool(object)) return asBool(object);
+  return true;
+}
 }
 
 namespace fmt {
@@ -25,16 +114,13 @@ struct formatter<lox::Object> {
 
   template<typename FormatContext>
   auto format(const lox::Object& obj, FormatContext& ctx) const {
-    using namespace boost::hana;
-    using namespace std;
-
-    // Cannot use overload_linearly() due to implicit double <-> bool conversion.
-    return format_to(ctx.out(), "{}", visit(overload(
-      [](std::monostate) { return "nil"s; },
-      [](const double val) { return fmt::format("{}", val); },
-      [](const string& val) { return val; },
-      [](const bool val) { return fmt::format("{}", val); }
-    ), obj));
+    using namespace lox;
+
+    if (isNil(obj)) return format_to(ctx.out(), "nil");
+    if (isBool(obj)) return format_to(ctx.out(), "{}", asBool(obj));
+    if (isNumber(obj)) return format_to(ctx.out(), "{}", asNumber(obj));
+    if (isString(obj)) return format_to(ctx.out(), "{}", asString(obj));
+    return format_to(ctx.out(), "{}", to_string(asCallable(obj)));
   }
 };
 }
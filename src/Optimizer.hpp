@@ -0,0 +1,165 @@
+#pragma once
+
+#include "Arena.hpp"
+#include "Ast.hpp"
+#include "Object.hpp"
+#include "TokenType.hpp"
+
+#include <boost/hana/functional/overload_linearly.hpp>
+
+#include <functional>
+#include <optional>
+#include <variant>
+#include <vector>
+
+namespace lox {
+// Rewrites a resolved syntax tree in place before it is executed or
+// compiled. It folds operators whose operands are all literals, drops
+// Grouping nodes, picks the live branch of an `if` with a constant condition
+// and removes `while` loops that can never run. Loops whose condition is
+// constantly true keep an empty condition, which both engines treat as
+// "loop forever" without evaluating anything.
+//
+// Runs after the Resolver, so code it removes is still checked for static
+// errors. Operations that would fail at runtime (`-"a"`, `1 + nil`) are left
+// alone so the error is still raised when, and only if, they execute.
+struct Optimizer {
+  // New Literal nodes are allocated next to the nodes they replace.
+  Arena& arena;
+
+  auto optimize(std::span<Stmt> statements) -> void {
+    for (auto&& statement: statements) {
+      optimize(statement);
+    }
+  }
+
+  auto optimize(Stmt& statement) -> void {
+    using namespace boost::hana;
+    using namespace std;
+
+    visit(overload_linearly(
+      [](std::monostate) {},
+      [this](Block* stmt) { optimize(stmt->statements); },
+      [this](Expression* stmt) { optimize(stmt->expression); },
+      [this](Function* stmt) { optimize(stmt->body); },
+      [this, &statement](IfStmt* stmt) {
+        optimize(stmt->condition);
+        optimize(stmt->thenBranch);
+        optimize(stmt->elseBranch);
+
+        if (auto&& condition = constant(stmt->condition)) {
+          statement = isTruthy(*condition) ? stmt->thenBranch : stmt->elseBranch;
+        }
+      },
+      [this](Print* stmt) { optimize(stmt->expression); },
+      [this](Return* stmt) { optimize(stmt->value); },
+      [this](Var* stmt) { optimize(stmt->initializer); },
+      [this, &statement](While* stmt) {
+        optimize(stmt->condition);
+        optimize(stmt->body);
+
+        if (auto&& condition = constant(stmt->condition)) {
+          if (!isTruthy(*condition)) {
+            statement = monostate{};
+            return;
+          }
+          stmt->condition = monostate{};
+        }
+      }
+    ), statement);
+  }
+
+  auto optimize(Expr& expression) -> void {
+    using namespace boost::hana;
+    using namespace std;
+
+    visit(overload_linearly(
+      [](std::monostate) {},
+      [this](Assign* expr) { optimize(expr->value); },
+      [this, &expression](Binary* expr) {
+        optimize(expr->left);
+        optimize(expr->right);
+
+        auto&& left = constant(expr->left);
+        auto&& right = constant(expr->right);
+        if (!left || !right) return;
+
+        if (auto&& value = fold(expr->op.type, *left, *right)) {
+          expression = arena.make<Literal>(std::move(*value));
+        }
+      },
+      [this](Call* expr) {
+        optimize(expr->callee);
+        for (auto&& argument: expr->arguments) {
+          optimize(argument);
+        }
+      },
+      [this, &expression](Grouping* expr) {
+        optimize(expr->expression);
+        expression = expr->expression;
+      },
+      [](Literal*) {},
+      [this, &expression](Logical* expr) {
+        optimize(expr->left);
+        optimize(expr->right);
+
+        auto&& left = constant(expr->left);
+        if (!left) return;
+
+        // `or` yields its left operand when that is truthy and `and` when it
+        // is falsy; otherwise the result is whatever the right side yields.
+        auto&& shortCircuits = expr->op.type == TokenType::OR ? isTruthy(*left) : !isTruthy(*left);
+        expression = shortCircuits ? expr->left : expr->right;
+      },
+      [this, &expression](Unary* expr) {
+        optimize(expr->right);
+
+        auto&& right = constant(expr->right);
+        if (!right) return;
+
+        if (expr->op.type == TokenType::BANG) {
+          expression = arena.make<Literal>(!isTruthy(*right));
+        } else if (expr->op.type == TokenType::MINUS && isNumber(*right)) {
+          expression = arena.make<Literal>(-asNumber(*right));
+        }
+      },
+      [](Variable*) {}
+    ), expression);
+  }
+
+  static auto constant(const Expr& expression) -> std::optional<Object> {
+    if (auto&& literal = std::get_if<Literal*>(&expression)) return (*literal)->value;
+    return {};
+  }
+
+  // The value the Interpreter would produce for `left op right`, or nothing
+  // when it would raise a runtime error instead.
+  static auto fold(TokenType op, const Object& left, const Object& right) -> std::optional<Object> {
+    using enum TokenType;
+
+    if (op == EQUAL_EQUAL) return isEqual(left, right);
+    if (op == BANG_EQUAL) return !isEqual(left, right);
+
+    if (isString(left) && isString(right)) {
+      if (op == PLUS) return LoxString::concat(asLoxString(left), asLoxString(right));
+      return {};
+    }
+
+    if (!isNumber(left) || !isNumber(right)) return {};
+
+    auto&& a = asNumber(left);
+    auto&& b = asNumber(right);
+    switch (op) {
+      case PLUS: return a + b;
+      case MINUS: return a - b;
+      case STAR: return a * b;
+      case SLASH: return a / b;
+      case GREATER: return std::greater<double>{}(a, b);
+      case GREATER_EQUAL: return std::greater_equal<double>{}(a, b);
+      case LESS: return std::less<double>{}(a, b);
+      case LESS_EQUAL: return std::less_equal<double>{}(a, b);
+      default: return {};
+    }
+  }
+};
+}
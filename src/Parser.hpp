@@ -1,12 +1,19 @@
 #pragma once
 
+#include "Arena.hpp"
 #include "Ast.hpp"
-#include "Lox.hpp"
+#include "Diagnostics.hpp"
+#include "Scanner.hpp"
 #include "TokenType.hpp"
 
 #include <cstddef>
 #include <cstdio>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -15,10 +22,18 @@ namespace lox {
 struct Parser {
   struct ParseError{};
 
+  Diagnostics& diagnostics;
   std::vector<lox::Token> tokens = {};
   std::size_t current = {};
-
-  auto parse() -> std::vector<Stmt> {
+  std::unique_ptr<Arena> arena = std::make_unique<Arena>();
+  bool declaresFunctions = {};
+  // When set, tokens are pulled from the scanner as the parser needs them
+  // instead of being supplied up front.
+  Scanner* scanner = {};
+  std::size_t expressionNodes = {};
+  std::size_t statementNodes = {};
+
+  auto parse() -> SyntaxTree {
     using namespace std;
 
     auto&& statements = vector<Stmt>{};
@@ -26,7 +41,39 @@ struct Parser {
       statements.push_back(declaration());
     }
 
-    return statements;
+    return SyntaxTree{std::move(arena), std::move(statements), declaresFunctions};
+  }
+
+  // Parses a single top-level declaration into its own tree, or returns
+  // nothing at the end of input. Tokens consumed by earlier declarations are
+  // released first, so streaming keeps only the current declaration around.
+  auto next() -> std::optional<SyntaxTree> {
+    using namespace std;
+
+    tokens.erase(tokens.begin(), tokens.begin() + static_cast<ptrdiff_t>(current));
+    current = 0;
+
+    if (isAtEnd()) return {};
+
+    auto&& statements = vector<Stmt>{};
+    statements.push_back(declaration());
+
+    return SyntaxTree{
+      exchange(arena, make_unique<Arena>()),
+      std::move(statements),
+      exchange(declaresFunctions, false),
+    };
+  }
+
+  // Allocates a node in the current arena, counting it for --stats.
+  template<typename T, typename... Args>
+  auto make(Args&&... args) -> T* {
+    if constexpr (std::is_constructible_v<Expr, T*>) {
+      expressionNodes++;
+    } else {
+      statementNodes++;
+    }
+    return arena->make<T>(std::forward<Args>(args)...);
   }
 
   auto expression() -> Expr {
@@ -56,7 +103,7 @@ struct Parser {
     if (match<PRINT>()) return printStatement();
     if (match<RETURN>()) return returnStatement();
     if (match<WHILE>()) return whileStatement();
-    if (match<LEFT_BRACE>()) return make_unique<Block>(block());
+    if (match<LEFT_BRACE>()) return make<Block>(block());
 
     return expressionStatement();
   }
@@ -92,18 +139,18 @@ struct Parser {
     if (increment != Expr{monostate{}}) {
       auto&& tmp = vector<Stmt>{};
       tmp.emplace_back(std::move(body));
-      tmp.emplace_back(make_unique<Expression>(std::move(increment)));
-      body = make_unique<Block>(std::move(tmp));
+      tmp.emplace_back(make<Expression>(std::move(increment)));
+      body = make<Block>(arena->list(std::move(tmp)));
     }
 
-    if (condition == Expr{monostate{}}) condition = make_unique<Literal>(true);
-    body = make_unique<While>(std::move(condition), std::move(body));
+    if (condition == Expr{monostate{}}) condition = make<Literal>(true);
+    body = make<While>(std::move(condition), std::move(body));
 
     if (initializer != Stmt{monostate{}}) {
       auto&& tmp = vector<Stmt>{};
       tmp.emplace_back(std::move(initializer));
       tmp.emplace_back(std::move(body));
-      body = make_unique<Block>(std::move(tmp));
+      body = make<Block>(arena->list(std::move(tmp)));
     }
 
     return body;
@@ -123,7 +170,7 @@ struct Parser {
       elseBranch = statement();
     }
 
-    return make_unique<IfStmt>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
+    return make<IfStmt>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
   }
 
   auto printStatement() -> Stmt {
@@ -132,7 +179,7 @@ struct Parser {
 
     auto&& value = expression();
     consume(SEMICOLON, "Expect ';' after value.");
-    return make_unique<Print>(std::move(value));
+    return make<Print>(std::move(value));
   }
 
   auto returnStatement() -> Stmt {
@@ -146,7 +193,7 @@ struct Parser {
     }
 
     consume(SEMICOLON, "Expect ';' after return value.");
-    return make_unique<Return>(std::move(keyword), std::move(value));
+    return make<Return>(std::move(keyword), std::move(value));
   }
 
   auto varDeclaration() -> Stmt {
@@ -160,7 +207,7 @@ struct Parser {
     }
 
     consume(SEMICOLON, "Expect ';' after variable declaration.");
-    return make_unique<Var>(std::move(name), std::move(initializer));
+    return make<Var>(std::move(name), std::move(initializer));
   }
 
   auto whileStatement() -> Stmt {
@@ -172,7 +219,7 @@ struct Parser {
     consume(RIGHT_PAREN, "Expect ')' after condition.");
     auto&& body = statement();
 
-    return make_unique<While>(std::move(condition), std::move(body));
+    return make<While>(std::move(condition), std::move(body));
   }
 
   auto expressionStatement() -> Stmt {
@@ -181,10 +228,10 @@ struct Parser {
     
     auto&& expr = expression();
     consume(SEMICOLON, "Expect ';' after expression.");
-    return make_unique<Expression>(std::move(expr));
+    return make<Expression>(std::move(expr));
   }
 
-  auto function(std::string_view kind) -> std::unique_ptr<Function> {
+  auto function(std::string_view kind) -> Function* {
     using enum TokenType;
     using namespace fmt;
     using namespace std;
@@ -203,10 +250,11 @@ struct Parser {
     consume(RIGHT_PAREN, "Expect ')' after parameters.");
     consume(LEFT_BRACE, format("Expect '{{' before {} body.", kind));
     auto&& body = block();
-    return make_unique<Function>(std::move(name), std::move(parameters), std::move(body));
+    declaresFunctions = true;
+    return make<Function>(std::move(name), arena->list(std::move(parameters)), body);
   }
 
-  auto block() -> std::vector<Stmt> {
+  auto block() -> std::span<Stmt> {
     using enum TokenType;
     using namespace std;
 
@@ -216,7 +264,7 @@ struct Parser {
     }
 
     consume(RIGHT_BRACE, "Expect '}' after block.");
-    return statements;
+    return arena->list(std::move(statements));
   }
 
   auto assignment() -> Expr {
@@ -229,8 +277,8 @@ struct Parser {
       auto&& equals = previous();
       auto&& value = assignment();
 
-      if (auto&& var = get_if<std::unique_ptr<Variable>>(&expr)) {
-        return make_unique<Assign>(std::move((*var)->name), std::move(value));
+      if (auto&& var = get_if<Variable*>(&expr)) {
+        return make<Assign>(std::move((*var)->name), std::move(value));
       }
 
       error(equals, "Invalid assignment target.");
@@ -248,7 +296,7 @@ struct Parser {
     while (match<OR>()) {
       auto&& op = previous();
       auto&& right = conjuction();
-      expr = make_unique<Logical>(std::move(expr), std::move(op), std::move(right));
+      expr = make<Logical>(std::move(expr), std::move(op), std::move(right));
     }
 
     return expr;
@@ -263,7 +311,7 @@ struct Parser {
     while (match<AND>()) {
       auto&& op = previous();
       auto&& right = equality();
-      expr = make_unique<Logical>(std::move(expr), std::move(op), std::move(right));
+      expr = make<Logical>(std::move(expr), std::move(op), std::move(right));
     }
 
     return expr;
@@ -276,7 +324,7 @@ struct Parser {
     while (match<BANG_EQUAL, EQUAL_EQUAL>()) {
       auto&& op = previous();
       auto&& right = comparison();
-      expr = make_unique<Binary>(std::move(expr), std::move(op), std::move(right));
+      expr = make<Binary>(std::move(expr), std::move(op), std::move(right));
     }
 
     return expr;
@@ -289,7 +337,7 @@ struct Parser {
     while (match<GREATER, GREATER_EQUAL, LESS, LESS_EQUAL>()) {
       auto&& op = previous();
       auto&& right = term();
-      expr = make_unique<Binary>(std::move(expr), std::move(op), std::move(right));
+      expr = make<Binary>(std::move(expr), std::move(op), std::move(right));
     }
 
     return expr;
@@ -302,7 +350,7 @@ struct Parser {
     while (match<MINUS, PLUS>()) {
       auto&& op = previous();
       auto&& right = factor();
-      expr = make_unique<Binary>(std::move(expr), std::move(op), std::move(right));
+      expr = make<Binary>(std::move(expr), std::move(op), std::move(right));
     }
 
     return expr;
@@ -315,7 +363,7 @@ struct Parser {
     while (match<SLASH, STAR>()) {
       auto&& op = previous();
       auto&& right = unary();
-      expr = make_unique<Binary>(std::move(expr), std::move(op), std::move(right));
+      expr = make<Binary>(std::move(expr), std::move(op), std::move(right));
     }
 
     return expr;
@@ -327,7 +375,7 @@ struct Parser {
     if (match<BANG, MINUS>()) {
       auto&& op = previous();
       auto&& right = unary();
-      return make_unique<Unary>(std::move(op), std::move(right));
+      return make<Unary>(std::move(op), std::move(right));
     }
 
     return call();
@@ -349,7 +397,7 @@ struct Parser {
 
     auto&& paren = consume(RIGHT_PAREN, "Expect ')' after arguments.");
 
-    return make_unique<Call>(std::move(callee), std::move(paren), std::move(arguments));
+    return make<Call>(std::move(callee), std::move(paren), arena->list(std::move(arguments)));
   }
 
   auto call() -> Expr {
@@ -364,28 +412,29 @@ struct Parser {
         break;
       }
     }
+
+    return expr;
   }
 
   auto primary() -> Expr {
     using enum TokenType;
     using namespace std;
 
-    if (match<FALSE>()) return make_unique<Literal>(false);
-    if (match<TRUE>()) return make_unique<Literal>(true);
-    if (match<NIL>()) return make_unique<Literal>(monostate{});
+    if (match<FALSE>()) return make<Literal>(false);
+    if (match<TRUE>()) return make<Literal>(true);
+    if (match<NIL>()) return make<Literal>(monostate{});
 
-    if (match<NUMBER, STRING>()) {
-      return make_unique<Literal>(std::move(previous().literal));
-    }
+    if (match<NUMBER>()) return make<Literal>(get<double>(previous().literal));
+    if (match<STRING>()) return make<Literal>(LoxString::make(std::string{get<string_view>(previous().literal)}));
 
     if (match<IDENTIFIER>()) {
-      return make_unique<Variable>(previous());
+      return make<Variable>(previous());
     }
 
     if (match<LEFT_PAREN>()) {
       auto&& expr = expression();
       consume(RIGHT_PAREN, "Expect ')' after expression.");
-      return make_unique<Grouping>(std::move(expr));
+      return make<Grouping>(std::move(expr));
     }
 
     throw error(peek(), "Expect expression.");
@@ -424,6 +473,10 @@ struct Parser {
   }
 
   auto peek() -> Token {
+    if (scanner) {
+      while (current >= tokens.size()) tokens.push_back(scanner->nextToken());
+    }
+
     return tokens[current];
   }
 
@@ -432,7 +485,7 @@ struct Parser {
   }
 
   auto error(const Token& token, const std::string& message) -> ParseError {
-    ::lox::error(token, message);
+    diagnostics.error(token, message);
     return {};
   }
 
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace lox {
+// Hardware performance counters for the calling thread, read through
+// perf_event_open(2). Each event is opened on its own rather than as a group
+// so that a machine which lacks one of them (or a container that forbids all
+// of them) still reports whatever it can; missing events read as nothing.
+struct PerfCounters {
+  enum class Event: std::uint8_t {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    LLC_MISSES,
+  };
+
+  static constexpr std::size_t EVENT_COUNT = 5;
+
+  static constexpr std::array<std::string_view, EVENT_COUNT> NAMES = {
+    "cycles",
+    "instructions",
+    "branch-misses",
+    "L1-dcache-misses",
+    "LLC-misses",
+  };
+
+  // Counter deltas for one measured region. Plain data so it can be copied
+  // between processes as bytes.
+  struct Sample {
+    std::array<std::uint64_t, EVENT_COUNT> values = {};
+    std::array<bool, EVENT_COUNT> valid = {};
+
+    auto operator+=(const Sample& other) -> Sample& {
+      for (std::size_t i = 0; i < EVENT_COUNT; i++) {
+        values[i] += other.values[i];
+        valid[i] = valid[i] || other.valid[i];
+      }
+      return *this;
+    }
+
+    auto get(Event event) const -> std::optional<std::uint64_t> {
+      auto&& i = static_cast<std::size_t>(event);
+      if (!valid[i]) return {};
+      return values[i];
+    }
+  };
+
+  std::array<int, EVENT_COUNT> fds = {-1, -1, -1, -1, -1};
+  // Why the first unavailable event could not be opened, for the report.
+  std::string unavailable = {};
+
+  PerfCounters() = default;
+
+  PerfCounters(const PerfCounters&) = delete;
+  auto operator=(const PerfCounters&) -> PerfCounters& = delete;
+
+  PerfCounters(PerfCounters&& other) noexcept:
+    fds(std::exchange(other.fds, {-1, -1, -1, -1, -1})),
+    unavailable(std::move(other.unavailable))
+  {}
+
+  auto operator=(PerfCounters&& other) noexcept -> PerfCounters& {
+    if (this != &other) {
+      close();
+      fds = std::exchange(other.fds, {-1, -1, -1, -1, -1});
+      unavailable = std::move(other.unavailable);
+    }
+    return *this;
+  }
+
+  ~PerfCounters() {
+    close();
+  }
+
+  // Opens and starts every event that this kernel and machine allow. Never
+  // fails: check available() or the individual Sample entries instead.
+  static auto open() -> PerfCounters {
+    using enum Event;
+
+    auto&& counters = PerfCounters{};
+    counters.add(CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters.add(INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters.add(BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters.add(L1D_MISSES, PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_L1D));
+    counters.add(LLC_MISSES, PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_LL));
+    return counters;
+  }
+
+  auto available() const -> bool {
+    for (auto&& fd: fds) {
+      if (fd >= 0) return true;
+    }
+    return false;
+  }
+
+  // Raw running totals as the kernel reports them: the count, plus how long
+  // the event was enabled and how long it actually had a PMU register.
+  struct Reading {
+    struct Total {
+      std::uint64_t value = {};
+      std::uint64_t enabled = {};
+      std::uint64_t running = {};
+    };
+
+    std::array<Total, EVENT_COUNT> totals = {};
+    std::array<bool, EVENT_COUNT> valid = {};
+  };
+
+  auto read() const -> Reading {
+    auto&& reading = Reading{};
+    for (std::size_t i = 0; i < EVENT_COUNT; i++) {
+      if (fds[i] < 0) continue;
+
+      std::uint64_t buffer[3] = {};  // value, time enabled, time running
+      if (::read(fds[i], buffer, sizeof buffer) != sizeof buffer) continue;
+
+      reading.totals[i] = {buffer[0], buffer[1], buffer[2]};
+      reading.valid[i] = true;
+    }
+    return reading;
+  }
+
+  // Runs `region` and adds the counts it incurred to `into`.
+  template<typename F>
+  auto measure(Sample& into, F&& region) const -> decltype(region()) {
+    auto&& before = read();
+    if constexpr (std::is_void_v<decltype(region())>) {
+      region();
+      into += difference(read(), before);
+    } else {
+      decltype(auto) result = region();
+      into += difference(read(), before);
+      return result;
+    }
+  }
+
+  // The counts between two readings. The raw deltas are subtracted first and
+  // only then scaled up for the share of the interval the event was actually
+  // counting, when the kernel had to multiplex more events than the PMU has
+  // registers. Scaling the two totals separately and subtracting the
+  // estimates could go negative. An event that never ran in the interval,
+  // or whose totals went backwards, is left invalid.
+  static auto difference(const Reading& after, const Reading& before) -> Sample {
+    auto&& delta = Sample{};
+    for (std::size_t i = 0; i < EVENT_COUNT; i++) {
+      if (!after.valid[i] || !before.valid[i]) continue;
+
+      auto&& [value, enabled, running] = after.totals[i];
+      auto&& [value0, enabled0, running0] = before.totals[i];
+      if (value < value0 || enabled < enabled0 || running <= running0) continue;
+
+      auto&& count = value - value0;
+      auto&& enabledDelta = enabled - enabled0;
+      auto&& runningDelta = running - running0;
+      delta.values[i] = runningDelta < enabledDelta
+        ? static_cast<std::uint64_t>(static_cast<double>(count) * static_cast<double>(enabledDelta) / static_cast<double>(runningDelta))
+        : count;
+      delta.valid[i] = true;
+    }
+    return delta;
+  }
+
+  static constexpr auto cache(std::uint64_t level) -> std::uint64_t {
+    return level | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  }
+
+  auto add(Event event, std::uint32_t type, std::uint64_t config) -> void {
+    auto&& attributes = perf_event_attr{};
+    attributes.size = sizeof attributes;
+    attributes.type = type;
+    attributes.config = config;
+    attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+
+    auto&& fd = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    if (fd < 0) {
+      if (unavailable.empty()) {
+        unavailable = std::string{NAMES[static_cast<std::size_t>(event)]} + ": " + std::strerror(errno);
+      }
+      return;
+    }
+
+    fds[static_cast<std::size_t>(event)] = fd;
+  }
+
+  auto close() -> void {
+    for (auto&& fd: fds) {
+      if (fd >= 0) ::close(fd);
+      fd = -1;
+    }
+  }
+};
+}
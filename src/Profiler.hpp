@@ -0,0 +1,198 @@
+#pragma once
+
+#include "Ast.hpp"
+
+#include <boost/hana/functional/overload_linearly.hpp>
+#include <fmt/format.h>
+#include <fmt/os.h>
+
+#include <sys/time.h>
+
+#include <algorithm>
+#include <csignal>
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace lox {
+// Statistical profiler for Lox code. A SIGPROF interval timer only raises a
+// flag; the engines look at the flag at points they pass through anyway (the
+// tree walker per statement, the VM on calls, returns and loop back-edges) and then
+// hand the profiler the current Lox call stack. Nothing is recorded between
+// ticks, so the cost of leaving it on is a flag test plus, for the tree
+// walker, keeping its shadow stack up to date.
+struct Profiler {
+  static constexpr long INTERVAL_US = 1000;
+
+  // One entry of a sampled call stack, outermost first.
+  struct Location {
+    std::string_view function;
+    std::size_t line = {};
+  };
+
+  // The tree walker's shadow stack: the function being run and the
+  // statement it is currently executing.
+  struct Frame {
+    std::string_view function;
+    const Stmt* statement = {};
+  };
+
+  struct LineHits {
+    std::size_t self = {};
+    std::size_t total = {};
+  };
+
+  inline static volatile std::sig_atomic_t pending = 0;
+
+  std::vector<Frame> frames = {Frame{"<script>"}};
+  std::unordered_map<std::string, std::size_t> stacks = {};
+  std::map<std::size_t, LineHits> lines = {};
+  std::size_t samples = {};
+  struct sigaction previous = {};
+  bool running = {};
+
+  Profiler() = default;
+
+  Profiler(const Profiler&) = delete;
+  auto operator=(const Profiler&) -> Profiler& = delete;
+
+  ~Profiler() {
+    stop();
+  }
+
+  auto start() -> void {
+    struct sigaction action = {};
+    action.sa_handler = [](int) { pending = 1; };
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &previous);
+
+    auto&& timer = itimerval{{0, INTERVAL_US}, {0, INTERVAL_US}};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    running = true;
+  }
+
+  auto stop() -> void {
+    if (!running) return;
+
+    auto&& timer = itimerval{};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &previous, nullptr);
+    running = false;
+    pending = 0;
+  }
+
+  auto enter(std::string_view function) -> void {
+    frames.push_back(Frame{function});
+  }
+
+  auto leave() -> void {
+    frames.pop_back();
+  }
+
+  // Called by the tree walker before each statement.
+  auto at(const Stmt& statement) -> void {
+    frames.back().statement = &statement;
+    if (pending) sampleFrames();
+  }
+
+  auto sampleFrames() -> void {
+    auto&& stack = std::vector<Location>{};
+    for (auto&& frame: frames) {
+      stack.push_back(Location{frame.function, frame.statement ? line(*frame.statement) : 0});
+    }
+    record(stack);
+  }
+
+  auto record(const std::vector<Location>& stack) -> void {
+    pending = 0;
+    samples++;
+
+    auto&& folded = std::string{};
+    auto&& seen = std::set<std::size_t>{};
+    for (auto&& location: stack) {
+      if (!folded.empty()) folded += ';';
+      folded += location.function;
+
+      // Recursion puts the same line on the stack many times; it still only
+      // accounts for one sample.
+      if (location.line != 0 && seen.insert(location.line).second) lines[location.line].total++;
+    }
+    stacks[folded]++;
+
+    if (!stack.empty() && stack.back().line != 0) lines[stack.back().line].self++;
+  }
+
+  // Brendan Gregg's folded format: one `outer;inner;leaf count` line per
+  // distinct stack, ready for flamegraph.pl.
+  auto writeFolded(const std::string& path) const -> void {
+    using namespace fmt;
+
+    auto&& sorted = std::vector<std::pair<std::string_view, std::size_t>>(stacks.begin(), stacks.end());
+    std::ranges::sort(sorted);
+
+    auto&& out = output_file(path);
+    for (auto&& [stack, count]: sorted) {
+      out.print("{} {}\n", stack, count);
+    }
+  }
+
+  // Lines ordered by the samples that landed on them directly.
+  auto reportLines() const -> void {
+    using namespace fmt;
+
+    auto&& sorted = std::vector<std::pair<std::size_t, LineHits>>(lines.begin(), lines.end());
+    std::ranges::stable_sort(sorted, std::greater{}, [](auto&& entry) { return entry.second.self; });
+
+    auto&& percent = [this](std::size_t hits) {
+      return samples == 0 ? 0.0 : 100.0 * static_cast<double>(hits) / static_cast<double>(samples);
+    };
+
+    print(stderr, "-- profile: {} samples --\n", samples);
+    print(stderr, "{:>8}{:>10}{:>8}{:>10}{:>8}\n", "line", "self", "%", "total", "%");
+    for (auto&& [number, hits]: sorted) {
+      print(stderr, "{:>8}{:>10}{:>7.1f}%{:>10}{:>7.1f}%\n", number, hits.self, percent(hits.self), hits.total, percent(hits.total));
+    }
+  }
+
+  // First source line a node's tokens point at, or 0 for nodes made only of
+  // literals.
+  static auto line(const Expr& expression) -> std::size_t {
+    using namespace boost::hana;
+
+    return std::visit(overload_linearly(
+      [](std::monostate) -> std::size_t { return 0; },
+      [](Assign* expr) -> std::size_t { return expr->name.line; },
+      [](Binary* expr) -> std::size_t { return expr->op.line; },
+      [](Call* expr) -> std::size_t { return expr->paren.line; },
+      [](Grouping* expr) -> std::size_t { return line(expr->expression); },
+      [](Literal*) -> std::size_t { return 0; },
+      [](Logical* expr) -> std::size_t { return expr->op.line; },
+      [](Unary* expr) -> std::size_t { return expr->op.line; },
+      [](Variable* expr) -> std::size_t { return expr->name.line; }
+    ), expression);
+  }
+
+  static auto line(const Stmt& statement) -> std::size_t {
+    using namespace boost::hana;
+
+    return std::visit(overload_linearly(
+      [](std::monostate) -> std::size_t { return 0; },
+      [](Block* stmt) -> std::size_t { return stmt->statements.empty() ? 0 : line(stmt->statements.front()); },
+      [](Expression* stmt) -> std::size_t { return line(stmt->expression); },
+      [](Function* stmt) -> std::size_t { return stmt->name.line; },
+      [](IfStmt* stmt) -> std::size_t { return line(stmt->condition); },
+      [](Print* stmt) -> std::size_t { return line(stmt->expression); },
+      [](Return* stmt) -> std::size_t { return stmt->keyword.line; },
+      [](Var* stmt) -> std::size_t { return stmt->name.line; },
+      [](While* stmt) -> std::size_t { return line(stmt->condition); }
+    ), statement);
+  }
+};
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "Ast.hpp"
+#include "Diagnostics.hpp"
+#include "Symbol.hpp"
+#include "TokenType.hpp"
+
+#include <boost/hana/functional/overload_linearly.hpp>
+
+#include <cstddef>
+#include <optional>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace lox {
+// Static pass run between parsing and interpretation. Every local variable
+// reference gets the (depth, slot) of its declaration so the Interpreter can
+// read it by index instead of hashing its name up the environment chain.
+struct Resolver {
+  enum class FunctionType {
+    NONE,
+    FUNCTION,
+  };
+
+  struct Local {
+    std::size_t slot = {};
+    bool defined = {};
+  };
+
+  using Scope = std::unordered_map<Symbol, Local>;
+
+  Diagnostics& diagnostics;
+  std::vector<Scope> scopes = {};
+  FunctionType currentFunction = FunctionType::NONE;
+
+  auto resolve(std::span<const Stmt> statements) -> void {
+    for (auto&& statement: statements) {
+      resolve(statement);
+    }
+  }
+
+  auto resolve(const Stmt& statement) -> void {
+    using namespace boost::hana;
+    using namespace std;
+
+    visit(overload_linearly(
+      [](std::monostate) {},
+      [this](Block* stmt) {
+        beginScope();
+        resolve(stmt->statements);
+        endScope();
+      },
+      [this](Expression* stmt) {
+        resolve(stmt->expression);
+      },
+      [this](Function* stmt) {
+        stmt->slot = declare(stmt->name);
+        define(stmt->name);
+
+        resolveFunction(*stmt, FunctionType::FUNCTION);
+      },
+      [this](IfStmt* stmt) {
+        resolve(stmt->condition);
+        resolve(stmt->thenBranch);
+        resolve(stmt->elseBranch);
+      },
+      [this](Print* stmt) {
+        resolve(stmt->expression);
+      },
+      [this](Return* stmt) {
+        if (currentFunction == FunctionType::NONE) {
+          diagnostics.error(stmt->keyword, "Can't return from top-level code.");
+        }
+
+        resolve(stmt->value);
+      },
+      [this](Var* stmt) {
+        stmt->slot = declare(stmt->name);
+        resolve(stmt->initializer);
+        define(stmt->name);
+      },
+      [this](While* stmt) {
+        resolve(stmt->condition);
+        resolve(stmt->body);
+      }
+    ), statement);
+  }
+
+  auto resolve(const Expr& expression) -> void {
+    using namespace boost::hana;
+    using namespace std;
+
+    visit(overload_linearly(
+      [](std::monostate) {},
+      [this](Assign* expr) {
+        resolve(expr->value);
+        expr->binding = resolveLocal(expr->name);
+      },
+      [this](Binary* expr) {
+        resolve(expr->left);
+        resolve(expr->right);
+      },
+      [this](Call* expr) {
+        resolve(expr->callee);
+
+        for (auto&& argument: expr->arguments) {
+          resolve(argument);
+        }
+      },
+      [this](Grouping* expr) {
+        resolve(expr->expression);
+      },
+      [](Literal*) {},
+      [this](Logical* expr) {
+        resolve(expr->left);
+        resolve(expr->right);
+      },
+      [this](Unary* expr) {
+        resolve(expr->right);
+      },
+      [this](Variable* expr) {
+        if (!scopes.empty()) {
+          auto&& scope = scopes.back();
+          if (auto&& it = scope.find(expr->name.symbol); it != scope.end() && !it->second.defined) {
+            diagnostics.error(expr->name, "Can't read local variable in its own initializer.");
+          }
+        }
+
+        expr->binding = resolveLocal(expr->name);
+      }
+    ), expression);
+  }
+
+  auto resolveFunction(const Function& function, FunctionType type) -> void {
+    auto enclosingFunction = currentFunction;
+    currentFunction = type;
+
+    // Parameters occupy the first slots of the call environment and the body
+    // shares that environment, mirroring LoxFunction::call.
+    beginScope();
+    for (auto&& param: function.params) {
+      declare(param);
+      define(param);
+    }
+    resolve(function.body);
+    endScope();
+
+    currentFunction = enclosingFunction;
+  }
+
+  auto resolveLocal(const Token& name) -> std::optional<Binding> {
+    for (auto i = scopes.size(); i-- > 0;) {
+      if (auto&& it = scopes[i].find(name.symbol); it != scopes[i].end()) {
+        return Binding{scopes.size() - 1 - i, it->second.slot};
+      }
+    }
+
+    // Not found. Assume it is global.
+    return {};
+  }
+
+  auto declare(const Token& name) -> std::optional<std::size_t> {
+    if (scopes.empty()) return {};
+
+    auto&& scope = scopes.back();
+    if (scope.contains(name.symbol)) {
+      diagnostics.error(name, "Already a variable with this name in this scope.");
+      return scope[name.symbol].slot;
+    }
+
+    auto&& slot = scope.size();
+    scope.insert({name.symbol, Local{slot, false}});
+    return slot;
+  }
+
+  auto define(const Token& name) -> void {
+    if (scopes.empty()) return;
+    scopes.back()[name.symbol].defined = true;
+  }
+
+  auto beginScope() -> void {
+    scopes.emplace_back();
+  }
+
+  auto endScope() -> void {
+    scopes.pop_back();
+  }
+};
+}
@@ -1,9 +0,0 @@
-#pragma once
-
-#include "Object.hpp"
-
-namespace lox {
-struct ReturnException {
-  Object value;
-};
-}
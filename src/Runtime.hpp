@@ -0,0 +1,170 @@
+#pragma once
+
+#include "LoxCallable.hpp"
+#include "LoxString.hpp"
+#include "Native.hpp"
+#include "Object.hpp"
+#include "RuntimeError.hpp"
+#include "TokenType.hpp"
+
+#include <fmt/format.h>
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace lox {
+// The runtime library of programs translated by --emit-cpp (see
+// CppEmitter). Values are the interpreter's own Objects and Lox functions
+// are Natives wrapping C++ lambdas, so printing, equality, string handling
+// and every runtime error message are the tree walker's. Errors are thrown
+// as RuntimeError and reported by main().
+//
+// Operands are passed as braced lists, which C++ evaluates left to right
+// like Lox does.
+struct Runtime {
+  using Operands = std::array<Object, 2>;
+
+  // A global variable; reading one before it is defined is an error.
+  struct Global {
+    Object value = {};
+    bool defined = {};
+  };
+
+  [[noreturn]] static auto fail(std::size_t line, const std::string& message) -> void {
+    throw RuntimeError{Token{TokenType::LOX_EOF, "", {}, line}, message};
+  }
+
+  static auto string(std::string_view text) -> Object {
+    return Object{LoxString::make(std::string{text})};
+  }
+
+  template<typename F>
+  static auto function(std::string name, F body) -> Object {
+    return Object{Ref<LoxCallable>{Native::bind(std::move(name), std::move(body))}};
+  }
+
+  // The natives every Session defines.
+  static auto clock() -> Object {
+    return function("clock", [] {
+      using namespace std::chrono;
+      return duration<double>(system_clock::now().time_since_epoch()).count();
+    });
+  }
+
+  static auto define(Global& global, Object value) -> void {
+    global.value = std::move(value);
+    global.defined = true;
+  }
+
+  static auto get(const Global& global, std::string_view name, std::size_t line) -> const Object& {
+    if (!global.defined) fail(line, fmt::format("Undefined variable '{}'.", name));
+    return global.value;
+  }
+
+  static auto assign(Global& global, Object value, std::string_view name, std::size_t line) -> Object {
+    if (!global.defined) fail(line, fmt::format("Undefined variable {}.", name));
+    global.value = value;
+    return value;
+  }
+
+  template<std::size_t N>
+  static auto call(std::array<Object, N> values, std::size_t line) -> Object {
+    auto&& callee = values[0];
+    if (!isCallable(callee)) fail(line, "Can only call functions and classes.");
+
+    // Every callable a translated program can reach is a Native.
+    auto&& function = static_cast<const Native&>(asCallable(callee));
+    if (function.parameters != N - 1) {
+      fail(line, fmt::format("Expected {} arguments but got {}.", function.parameters, N - 1));
+    }
+
+    auto&& result = function.invoke(std::span<Object>{values}.subspan(1));
+    if (!result) fail(line, result.error());
+    return std::move(*result);
+  }
+
+  static auto numbers(const Operands& operands, std::size_t line) -> void {
+    if (!isNumber(operands[0]) || !isNumber(operands[1])) fail(line, "Operands must be numbers.");
+  }
+
+  static auto add(Operands operands, std::size_t line) -> Object {
+    auto&& [a, b] = operands;
+    if (isNumber(a) && isNumber(b)) return asNumber(a) + asNumber(b);
+    if (isString(a) && isString(b)) return LoxString::concat(asLoxString(a), asLoxString(b));
+    fail(line, "Operands must be two numbers or two strings");
+  }
+
+  static auto subtract(Operands operands, std::size_t line) -> Object {
+    numbers(operands, line);
+    return asNumber(operands[0]) - asNumber(operands[1]);
+  }
+
+  static auto multiply(Operands operands, std::size_t line) -> Object {
+    numbers(operands, line);
+    return asNumber(operands[0]) * asNumber(operands[1]);
+  }
+
+  static auto divide(Operands operands, std::size_t line) -> Object {
+    numbers(operands, line);
+    return asNumber(operands[0]) / asNumber(operands[1]);
+  }
+
+  static auto greater(Operands operands, std::size_t line) -> Object {
+    numbers(operands, line);
+    return asNumber(operands[0]) > asNumber(operands[1]);
+  }
+
+  static auto greaterEqual(Operands operands, std::size_t line) -> Object {
+    numbers(operands, line);
+    return asNumber(operands[0]) >= asNumber(operands[1]);
+  }
+
+  static auto less(Operands operands, std::size_t line) -> Object {
+    numbers(operands, line);
+    return asNumber(operands[0]) < asNumber(operands[1]);
+  }
+
+  static auto lessEqual(Operands operands, std::size_t line) -> Object {
+    numbers(operands, line);
+    return asNumber(operands[0]) <= asNumber(operands[1]);
+  }
+
+  static auto equal(Operands operands) -> Object {
+    return isEqual(operands[0], operands[1]);
+  }
+
+  static auto notEqual(Operands operands) -> Object {
+    return !isEqual(operands[0], operands[1]);
+  }
+
+  static auto negate(const Object& operand, std::size_t line) -> Object {
+    if (!isNumber(operand)) fail(line, "Operand must be a number.");
+    return -asNumber(operand);
+  }
+
+  static auto print(const Object& value) -> void {
+    fmt::print("{}\n", value);
+  }
+
+  // Runs `program` and reports a runtime error the way runFile does,
+  // returning its exit status.
+  template<typename F>
+  static auto main(F&& program) -> int {
+    try {
+      program();
+    } catch (const RuntimeError& error) {
+      fmt::print("{} \n[line {} ]", error.what(), error.token.line);
+      return 70;
+    }
+    return 0;
+  }
+};
+}
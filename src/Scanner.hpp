@@ -8,13 +8,14 @@
 #include <variant>
 #include <vector>
 
-#include "Lox.hpp"
+#include "Diagnostics.hpp"
 #include "Object.hpp"
+#include "Symbol.hpp"
 #include "TokenType.hpp"
 
 namespace lox {
 struct Scanner {
-  inline static std::unordered_map<std::string_view, TokenType> keywords = {
+  inline static const std::unordered_map<std::string_view, TokenType> keywords = {
     {"and", TokenType::AND},
     {"class", TokenType::CLASS},
     {"else", TokenType::ELSE},
@@ -33,19 +34,25 @@ struct Scanner {
     {"while", TokenType::WHILE},
   };
 
-  std::string source = {};
+  // Views the caller's buffer; tokens point into it, so it must outlive them.
+  std::string_view source = {};
+  SymbolTable& symbols;
+  Diagnostics& diagnostics;
   std::vector<Token> tokens = {};
   std::size_t start = {};
   std::size_t current = {};
   std::size_t line = {1};
+  // Tokens produced so far, excluding the final LOX_EOF.
+  std::size_t scanned = {};
 
   auto advance() -> char {
     return source[current++];
   }
 
-  auto addToken(TokenType type, Object literal) -> void {
+  auto addToken(TokenType type, TokenLiteral literal) -> void {
     auto&& text = source.substr(start, current - start);
     tokens.push_back(Token{type, text, literal, line});
+    scanned++;
   }
 
   auto addToken(TokenType type) -> void {
@@ -108,7 +115,7 @@ struct Scanner {
         } else if (isAlpha(c)) {
           identifier();
         } else {
-          lox::error(line, "Unexpected character.");
+          diagnostics.error(line, "Unexpected character.");
         }
         break;
     }
@@ -120,9 +127,13 @@ struct Scanner {
     while (isAlphaNumeric(peek())) advance();
 
     auto&& text = source.substr(start, current - start);
-    auto&& type = keywords.contains(text) ? keywords[text] : IDENTIFIER;
+    if (auto&& keyword = keywords.find(text); keyword != keywords.end()) {
+      addToken(keyword->second);
+      return;
+    }
 
-    addToken(type);
+    addToken(IDENTIFIER);
+    tokens.back().symbol = symbols.intern(text);
   }
 
   auto match(char expected) -> bool {
@@ -174,6 +185,23 @@ struct Scanner {
     return tokens;
   }
 
+  // Scans just far enough to produce the next token, for callers that consume
+  // the source incrementally. Returns LOX_EOF once the source is exhausted.
+  auto nextToken() -> Token {
+    using enum TokenType;
+
+    while (tokens.empty() && !isAtEnd()) {
+      start = current;
+      scanToken();
+    }
+
+    if (tokens.empty()) return Token{LOX_EOF, "clrf", std::monostate{}, line};
+
+    auto token = std::move(tokens.back());
+    tokens.pop_back();
+    return token;
+  }
+
   auto number() -> void {
     using enum TokenType;
 
@@ -188,7 +216,7 @@ struct Scanner {
     }
 
     auto&& value = double{};
-    std::from_chars(source.c_str() + start, source.c_str() + current, value);
+    std::from_chars(source.data() + start, source.data() + current, value);
     addToken(NUMBER, value);
   }
 
@@ -201,7 +229,7 @@ struct Scanner {
     }
 
     if (isAtEnd()) {
-      lox::error(line, "Unterminated string.");
+      diagnostics.error(line, "Unterminated string.");
       return;
     }
 
@@ -0,0 +1,526 @@
+#pragma once
+
+#include "Arena.hpp"
+#include "Ast.hpp"
+#include "LoxString.hpp"
+#include "Object.hpp"
+#include "SourceFile.hpp"
+#include "Symbol.hpp"
+#include "TokenType.hpp"
+
+#include <boost/hana/functional/overload_linearly.hpp>
+#include <fmt/format.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Interpreter version baked into cache keys, so an upgrade never loads trees
+// written by an older build. Set from the CMake project version.
+#ifndef LOX_VERSION
+#define LOX_VERSION "dev"
+#endif
+
+namespace lox {
+// Cache of resolved syntax trees on disk, so scripts that are run over and
+// over skip the Scanner, Parser and Resolver after the first run.
+//
+// Entries are named after a hash of the interpreter version and the script
+// text. Each holds a copy of the script, compared with the one being run so
+// that two scripts with the same hash never share an entry, followed by a
+// flat pre-order encoding of the tree. A hit maps the entry
+// read-only and rebuilds the nodes in a fresh Arena. Token lexemes point
+// straight into the mapping, so it has to outlive the tree. Entries are
+// written to a temporary file and renamed into place, which lets any number
+// of processes share a cache directory. Each reader maps the same page-cache
+// pages, and none of them sees a half-written entry.
+//
+// Trees are stored before optimization, so one entry serves runs with and
+// without --no-optimize. Anything unexpected in an entry (wrong magic,
+// version or hash, a different script, a payload that does not match its
+// checksum, truncation) makes it a miss. The checksum catches corrupted or edited
+// entries. It is not a defence against someone who can write the cache
+// directory on purpose.
+struct ScriptCache {
+  static constexpr std::uint32_t FORMAT_VERSION = 4;
+  static constexpr std::string_view MAGIC = "LOXTREE\n";
+
+  enum class Value: std::uint8_t {
+    NIL,
+    BOOL,
+    NUMBER,
+    STRING,
+  };
+
+  struct Writer {
+    std::string data = {};
+    // Set when the tree holds something that cannot be written.
+    bool failed = {};
+
+    template<typename T>
+    auto put(T value) -> void {
+      static_assert(std::is_trivially_copyable_v<T>);
+      data.append(reinterpret_cast<const char*>(&value), sizeof value);
+    }
+
+    auto put(std::string_view text) -> void {
+      put(static_cast<std::uint32_t>(text.size()));
+      data.append(text);
+    }
+  };
+
+  // Rebuilds a tree from an entry. Nodes are counted like the Parser counts
+  // them, for --stats.
+  struct Loader {
+    std::string_view data;
+    Arena& arena;
+    SymbolTable& symbols;
+    std::size_t position = {};
+    bool failed = {};
+    std::size_t expressionNodes = {};
+    std::size_t statementNodes = {};
+
+    template<typename T>
+    auto get() -> T {
+      auto&& value = T{};
+      if (data.size() - position < sizeof value) {
+        failed = true;
+        return value;
+      }
+
+      std::memcpy(&value, data.data() + position, sizeof value);
+      position += sizeof value;
+      return value;
+    }
+
+    // A view into the mapped entry.
+    auto text() -> std::string_view {
+      auto&& size = get<std::uint32_t>();
+      if (failed || data.size() - position < size) {
+        failed = true;
+        return {};
+      }
+
+      auto&& text = data.substr(position, size);
+      position += size;
+      return text;
+    }
+
+    auto flag() -> bool {
+      return get<std::uint8_t>() != 0;
+    }
+
+    // An element count, which cannot exceed the bytes left to read.
+    auto count() -> std::size_t {
+      auto&& count = std::size_t{get<std::uint32_t>()};
+      if (count > data.size() - position) {
+        failed = true;
+        return 0;
+      }
+      return count;
+    }
+
+    template<typename T>
+    auto optional() -> std::optional<T> {
+      if (!flag()) return {};
+      return get<T>();
+    }
+
+    template<typename T, typename... Args>
+    auto make(Args&&... args) -> T* {
+      if constexpr (std::is_constructible_v<Expr, T*>) {
+        expressionNodes++;
+      } else {
+        statementNodes++;
+      }
+      return arena.make<T>(std::forward<Args>(args)...);
+    }
+
+    auto object() -> Object {
+      using enum Value;
+
+      switch (get<Value>()) {
+        case NIL: return {};
+        case BOOL: return flag();
+        case NUMBER: return get<double>();
+        case STRING: return LoxString::make(std::string{text()});
+      }
+
+      failed = true;
+      return {};
+    }
+
+    auto token() -> Token {
+      auto&& type = get<TokenType>();
+      auto&& lexeme = text();
+      auto&& line = static_cast<std::size_t>(get<std::uint64_t>());
+      auto&& symbol = flag() ? symbols.intern(lexeme) : NO_SYMBOL;
+      return Token{type, lexeme, {}, line, symbol};
+    }
+
+    // Fields are read into locals first, since the order in which function
+    // arguments are evaluated is unspecified.
+    auto expression() -> Expr {
+      if (failed) return {};
+
+      switch (get<std::uint8_t>()) {
+        case 0: return {};
+        case 1: {
+          auto&& name = token();
+          auto&& value = expression();
+          auto&& binding = optional<Binding>();
+          return make<Assign>(std::move(name), std::move(value), binding);
+        }
+        case 2: {
+          auto&& left = expression();
+          auto&& op = token();
+          auto&& right = expression();
+          return make<Binary>(std::move(left), std::move(op), std::move(right));
+        }
+        case 3: {
+          auto&& callee = expression();
+          auto&& paren = token();
+          auto&& arguments = std::vector<Expr>(count());
+          for (auto&& argument: arguments) {
+            argument = expression();
+          }
+          return make<Call>(std::move(callee), std::move(paren), arena.list(std::move(arguments)));
+        }
+        case 4: return make<Grouping>(expression());
+        case 5: return make<Literal>(object());
+        case 6: {
+          auto&& left = expression();
+          auto&& op = token();
+          auto&& right = expression();
+          return make<Logical>(std::move(left), std::move(op), std::move(right));
+        }
+        case 7: {
+          auto&& op = token();
+          auto&& right = expression();
+          return make<Unary>(std::move(op), std::move(right));
+        }
+        case 8: {
+          auto&& name = token();
+          auto&& binding = optional<Binding>();
+          return make<Variable>(std::move(name), binding);
+        }
+      }
+
+      failed = true;
+      return {};
+    }
+
+    auto statements() -> std::vector<Stmt> {
+      auto&& statements = std::vector<Stmt>(count());
+      for (auto&& statement: statements) {
+        if (failed) break;
+        statement = this->statement();
+      }
+      return statements;
+    }
+
+    auto statement() -> Stmt {
+      if (failed) return {};
+
+      switch (get<std::uint8_t>()) {
+        case 0: return {};
+        case 1: return make<Block>(arena.list(statements()));
+        case 2: return make<Expression>(expression());
+        case 3: {
+          auto&& name = token();
+          auto&& params = std::vector<Token>(count());
+          for (auto&& param: params) {
+            param = token();
+          }
+          auto&& body = statements();
+          auto&& slot = optional<std::size_t>();
+          return make<Function>(std::move(name), arena.list(std::move(params)), arena.list(std::move(body)), slot);
+        }
+        case 4: {
+          auto&& condition = expression();
+          auto&& thenBranch = statement();
+          auto&& elseBranch = statement();
+          return make<IfStmt>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
+        }
+        case 5: return make<Print>(expression());
+        case 6: {
+          auto&& keyword = token();
+          auto&& value = expression();
+          return make<Return>(std::move(keyword), std::move(value));
+        }
+        case 7: {
+          auto&& name = token();
+          auto&& initializer = expression();
+          auto&& slot = optional<std::size_t>();
+          return make<Var>(std::move(name), std::move(initializer), slot);
+        }
+        case 8: {
+          auto&& condition = expression();
+          auto&& body = statement();
+          return make<While>(std::move(condition), std::move(body));
+        }
+      }
+
+      failed = true;
+      return {};
+    }
+  };
+
+  // Laid out without padding, so every byte of an entry is defined.
+  struct Header {
+    char magic[8] = {};
+    std::uint32_t version = {};
+    std::uint32_t declaresFunctions = {};
+    std::uint64_t key = {};
+    // Of everything after the header.
+    std::uint64_t checksum = {};
+  };
+
+  std::filesystem::path path = {};
+  std::uint64_t key = {};
+  // The entry loaded by a hit.
+  std::optional<SourceFile> mapping = {};
+  std::size_t expressionNodes = {};
+  std::size_t statementNodes = {};
+
+  static auto forSource(const std::string& directory, std::string_view source) -> ScriptCache {
+    auto&& key = hash(source, hash(LOX_VERSION, hash(std::string_view{reinterpret_cast<const char*>(&FORMAT_VERSION), sizeof FORMAT_VERSION})));
+    return ScriptCache{
+      .path = std::filesystem::path{directory} / fmt::format("{:016x}.loxtree", key),
+      .key = key,
+    };
+  }
+
+  // 64-bit FNV-1a; stable across builds and platforms, unlike std::hash.
+  static constexpr auto hash(std::string_view bytes, std::uint64_t seed = 0xcbf2'9ce4'8422'2325) -> std::uint64_t {
+    for (auto&& byte: bytes) {
+      seed ^= static_cast<unsigned char>(byte);
+      seed *= 0x0000'0100'0000'01b3;
+    }
+    return seed;
+  }
+
+  // FNV-1a over 64-bit words with an extra shift to mix high bits down,
+  // about eight times faster than hash() so every hit can afford it.
+  static auto checksum(std::string_view bytes) -> std::uint64_t {
+    auto&& sum = std::uint64_t{0xcbf2'9ce4'8422'2325} ^ bytes.size();
+    auto&& words = bytes.size() / sizeof sum;
+    for (std::size_t i = 0; i < words; i++) {
+      auto&& word = std::uint64_t{};
+      std::memcpy(&word, bytes.data() + i * sizeof word, sizeof word);
+      sum = (sum ^ word) * 0x0000'0100'0000'01b3;
+      sum ^= sum >> 32;
+    }
+    return hash(bytes.substr(words * sizeof sum), sum);
+  }
+
+  // The tree for `source`, which has to be the script the cache was made for.
+  auto load(std::string_view source, SymbolTable& symbols) -> std::optional<SyntaxTree> {
+    mapping = SourceFile::open(path.c_str());
+    if (!mapping) return {};
+
+    auto&& tree = SyntaxTree{std::make_unique<Arena>()};
+    auto&& loader = Loader{mapping->view(), *tree.arena, symbols};
+    auto&& header = loader.get<Header>();
+    if (loader.failed
+        || std::string_view{header.magic, sizeof header.magic} != MAGIC
+        || header.version != FORMAT_VERSION
+        || header.key != key
+        || header.checksum != checksum(loader.data.substr(sizeof header))
+        || loader.text() != source
+        || loader.failed) {
+      mapping.reset();
+      return {};
+    }
+
+    tree.declaresFunctions = header.declaresFunctions != 0;
+    tree.statements = loader.statements();
+    if (loader.failed || loader.position != loader.data.size()) {
+      mapping.reset();
+      return {};
+    }
+
+    expressionNodes = loader.expressionNodes;
+    statementNodes = loader.statementNodes;
+    return tree;
+  }
+
+  // Best effort: a cache that cannot be written only costs the next run its
+  // speedup.
+  auto store(std::string_view source, const SyntaxTree& tree) const -> void {
+    if (source.size() > std::numeric_limits<std::uint32_t>::max()) return;
+
+    auto&& writer = Writer{};
+    auto&& header = Header{};
+    std::memcpy(header.magic, MAGIC.data(), sizeof header.magic);
+    header.version = FORMAT_VERSION;
+    header.key = key;
+    header.declaresFunctions = tree.declaresFunctions;
+    writer.put(header);
+    writer.put(source);
+
+    write(writer, tree.statements);
+    if (writer.failed) return;
+
+    header.checksum = checksum(std::string_view{writer.data}.substr(sizeof header));
+    std::memcpy(writer.data.data(), &header, sizeof header);
+
+    auto&& error = std::error_code{};
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    auto&& temporary = path.string() + ".XXXXXX";
+    auto&& fd = ::mkostemp(temporary.data(), O_CLOEXEC);
+    if (fd < 0) return;
+    ::fchmod(fd, 0644);
+
+    auto&& remaining = std::string_view{writer.data};
+    while (!remaining.empty()) {
+      auto&& written = ::write(fd, remaining.data(), remaining.size());
+      if (written <= 0) break;
+      remaining.remove_prefix(static_cast<std::size_t>(written));
+    }
+    ::close(fd);
+
+    if (!remaining.empty() || ::rename(temporary.c_str(), path.c_str()) != 0) {
+      ::unlink(temporary.c_str());
+    }
+  }
+
+  static auto write(Writer& writer, const Object& value) -> void {
+    using enum Value;
+
+    if (isNil(value)) {
+      writer.put(NIL);
+    } else if (isBool(value)) {
+      writer.put(BOOL);
+      writer.put(asBool(value));
+    } else if (isNumber(value)) {
+      writer.put(NUMBER);
+      writer.put(asNumber(value));
+    } else if (isString(value)) {
+      writer.put(STRING);
+      writer.put(std::string_view{asString(value)});
+    } else {
+      writer.failed = true;
+    }
+  }
+
+  // Tokens kept in a tree never carry a literal; Literal nodes hold values.
+  static auto write(Writer& writer, const Token& token) -> void {
+    writer.put(token.type);
+    writer.put(token.lexeme);
+    writer.put(static_cast<std::uint64_t>(token.line));
+    writer.put(token.symbol != NO_SYMBOL);
+  }
+
+  template<typename T>
+  static auto write(Writer& writer, const std::optional<T>& value) -> void {
+    writer.put(value.has_value());
+    if (value) writer.put(*value);
+  }
+
+  static auto write(Writer& writer, const Expr& expression) -> void {
+    using namespace boost::hana;
+
+    writer.put(static_cast<std::uint8_t>(expression.index()));
+    std::visit(overload_linearly(
+      [](std::monostate) {},
+      [&](Assign* expr) {
+        write(writer, expr->name);
+        write(writer, expr->value);
+        write(writer, expr->binding);
+      },
+      [&](Binary* expr) {
+        write(writer, expr->left);
+        write(writer, expr->op);
+        write(writer, expr->right);
+      },
+      [&](Call* expr) {
+        write(writer, expr->callee);
+        write(writer, expr->paren);
+        writer.put(static_cast<std::uint32_t>(expr->arguments.size()));
+        for (auto&& argument: expr->arguments) {
+          write(writer, argument);
+        }
+      },
+      [&](Grouping* expr) { write(writer, expr->expression); },
+      [&](Literal* expr) { write(writer, expr->value); },
+      [&](Logical* expr) {
+        write(writer, expr->left);
+        write(writer, expr->op);
+        write(writer, expr->right);
+      },
+      [&](Unary* expr) {
+        write(writer, expr->op);
+        write(writer, expr->right);
+      },
+      [&](Variable* expr) {
+        write(writer, expr->name);
+        write(writer, expr->binding);
+      }
+    ), expression);
+  }
+
+  static auto write(Writer& writer, std::span<const Stmt> statements) -> void {
+    writer.put(static_cast<std::uint32_t>(statements.size()));
+    for (auto&& statement: statements) {
+      write(writer, statement);
+    }
+  }
+
+  static auto write(Writer& writer, const Stmt& statement) -> void {
+    using namespace boost::hana;
+
+    writer.put(static_cast<std::uint8_t>(statement.index()));
+    std::visit(overload_linearly(
+      [](std::monostate) {},
+      [&](Block* stmt) { write(writer, stmt->statements); },
+      [&](Expression* stmt) { write(writer, stmt->expression); },
+      [&](Function* stmt) {
+        write(writer, stmt->name);
+        writer.put(static_cast<std::uint32_t>(stmt->params.size()));
+        for (auto&& param: stmt->params) {
+          write(writer, param);
+        }
+        write(writer, stmt->body);
+        write(writer, stmt->slot);
+      },
+      [&](IfStmt* stmt) {
+        write(writer, stmt->condition);
+        write(writer, stmt->thenBranch);
+        write(writer, stmt->elseBranch);
+      },
+      [&](Print* stmt) { write(writer, stmt->expression); },
+      [&](Return* stmt) {
+        write(writer, stmt->keyword);
+        write(writer, stmt->value);
+      },
+      [&](Var* stmt) {
+        write(writer, stmt->name);
+        write(writer, stmt->initializer);
+        write(writer, stmt->slot);
+      },
+      [&](While* stmt) {
+        write(writer, stmt->condition);
+        write(writer, stmt->body);
+      }
+    ), statement);
+  }
+};
+}
@@ -0,0 +1,226 @@
+#include "Session.hpp"
+
+#include "ClosureCompiler.hpp"
+#include "Compiler.hpp"
+#include "Diagnostics.hpp"
+#include "Interpreter.hpp"
+#include "Jit.hpp"
+#include "Lox.hpp"
+#include "Optimizer.hpp"
+#include "Parser.hpp"
+#include "PerfCounters.hpp"
+#include "Profiler.hpp"
+#include "Resolver.hpp"
+#include "Scanner.hpp"
+#include "ScriptCache.hpp"
+#include "Stats.hpp"
+#include "Symbol.hpp"
+#include "Vm.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lox {
+struct Session::State {
+  // A program that defined functions the tree walker may still call. They
+  // point into its syntax trees, whose tokens point into its source text or
+  // cache entry.
+  struct Unit {
+    std::string source = {};
+    std::optional<ScriptCache> cache = {};
+    std::vector<SyntaxTree> trees = {};
+  };
+
+  Options options;
+  Diagnostics diagnostics;
+  SymbolTable symbols = {};
+  // Declared before the engines so they are destroyed after them.
+  std::vector<std::unique_ptr<Unit>> units = {};
+  // Only the engine selected by the options is constructed.
+  std::optional<Compiler> compiler = {};
+  std::optional<Vm> vm = {};
+  std::optional<Interpreter> interpreter = {};
+
+  State(Options options, Sink output, Sink errors):
+    options(std::move(options)),
+    diagnostics{std::move(errors)}
+  {
+    if (this->options.engine == Engine::VM) {
+      compiler.emplace(Compiler{diagnostics});
+      vm.emplace(diagnostics, std::move(output));
+      vm->jit = this->options.jit && Jit::SUPPORTED;
+    } else {
+      interpreter.emplace(diagnostics, std::move(output));
+    }
+  }
+};
+
+Session::Session(Options options, Sink output, Sink errors):
+  state(std::make_unique<State>(std::move(options), std::move(output), std::move(errors)))
+{
+  defineNative("clock", [] {
+    using namespace std::chrono;
+    return duration<double>(system_clock::now().time_since_epoch()).count();
+  });
+}
+
+Session::Session(Session&&) noexcept = default;
+
+auto Session::operator=(Session&&) noexcept -> Session& = default;
+
+Session::~Session() = default;
+
+auto Session::defineGlobal(std::string_view name, Object value) -> void {
+  auto&& symbol = state->symbols.intern(name);
+  if (state->interpreter) {
+    state->interpreter->globals->define(symbol, value);
+    return;
+  }
+
+  try {
+    state->vm->define(state->compiler->globalIndex(symbol, name), std::move(value));
+  } catch (const Compiler::CompileError&) {
+    // Out of global indices; the Compiler has reported it.
+  }
+}
+
+auto Session::jitStats() const -> JitStats {
+  return state->vm ? state->vm->jitStats : JitStats{};
+}
+
+auto Session::run(std::string_view source, Lifetime lifetime) -> Result {
+  using enum Result;
+  using namespace std;
+
+  auto&& options = state->options;
+  auto&& diagnostics = state->diagnostics;
+  auto&& vm = state->vm;
+  auto&& interpreter = state->interpreter;
+  diagnostics.reset();
+
+  auto&& unit = make_unique<State::Unit>();
+  auto&& scanner = Scanner{source, state->symbols, diagnostics};
+  auto&& resolver = Resolver{diagnostics};
+  auto&& stats = Stats{};
+  auto&& perf = options.perfCounters ? optional{PerfCounters::open()} : nullopt;
+  if (perf) stats.perf = &*perf;
+  auto&& profiler = Profiler{};
+  if (!options.profile.empty()) {
+    if (interpreter) interpreter->profiler = &profiler;
+    if (vm) vm->profiler = &profiler;
+    profiler.start();
+  }
+
+  auto&& resolve = [&](SyntaxTree& tree) {
+    stats.time(stats.resolve, [&] { resolver.resolve(tree.statements); });
+  };
+
+  auto&& execute = [&](SyntaxTree& tree) {
+    auto&& statements = tree.statements;
+    if (options.optimize) {
+      stats.time(stats.optimize, [&] { Optimizer{*tree.arena}.optimize(statements); });
+    }
+
+    if (vm) {
+      auto&& program = stats.time(stats.compile, [&] { return state->compiler->compile(statements); });
+
+      if (diagnostics.hadError) return;
+
+      stats.time(stats.execute, [&] { vm->interpret(program); });
+      return;
+    }
+
+    if (options.engine == Engine::CLOSURE) {
+      auto&& program = stats.time(stats.compile, [&] { return ClosureCompiler::compile(statements); });
+      stats.time(stats.execute, [&] { ClosureCompiler::interpret(*interpreter, program); });
+      return;
+    }
+
+    stats.time(stats.execute, [&] { interpreter->interpret(statements); });
+  };
+
+  // Trees the tree walker may call back into are kept with the unit.
+  auto&& retain = [&](SyntaxTree&& tree) {
+    if (tree.declaresFunctions && interpreter) unit->trees.push_back(std::move(tree));
+  };
+
+  auto&& report = [&](size_t expressionNodes, size_t statementNodes) {
+    if (!options.profile.empty()) {
+      profiler.stop();
+      profiler.writeFolded(options.profile);
+      profiler.reportLines();
+      if (interpreter) interpreter->profiler = nullptr;
+      if (vm) vm->profiler = nullptr;
+    }
+
+    if (!unit->trees.empty()) state->units.push_back(std::move(unit));
+
+    if (options.stats || options.perfCounters) {
+      stats.tokens = scanner.scanned;
+      stats.expressionNodes = expressionNodes;
+      stats.statementNodes = statementNodes;
+      stats.counters = vm ? vm->counters : interpreter->counters;
+      stats.gc = vm ? vm->heap.stats : interpreter->heap.stats;
+      if (vm) stats.jit = vm->jitStats;
+      stats.report(options);
+    }
+
+    if (diagnostics.hadError) return STATIC_ERROR;
+    if (diagnostics.hadRuntimeError) return RUNTIME_ERROR;
+    return OK;
+  };
+
+  // The tree walker keeps pointers into the source once it has run a
+  // function declaration. Unless the caller keeps the text alive, it scans a
+  // copy the Session can hold on to.
+  if (interpreter && lifetime == Lifetime::CALL) {
+    unit->source = source;
+    scanner.source = unit->source;
+  }
+
+  if (!options.stream) {
+    // On a hit the tree comes back already resolved. Lexemes in it point
+    // into the cache entry, which lives as long as the unit.
+    if (!options.cache.empty()) {
+      unit->cache = ScriptCache::forSource(options.cache, source);
+      if (auto&& tree = stats.time(stats.cache, [&] { return unit->cache->load(source, state->symbols); })) {
+        execute(*tree);
+        retain(std::move(*tree));
+        return report(unit->cache->expressionNodes, unit->cache->statementNodes);
+      }
+    }
+
+    auto&& tokens = stats.time(stats.scan, [&] { return scanner.scanTokens(); });
+    auto&& parser = Parser{diagnostics, tokens};
+    auto&& tree = stats.time(stats.parse, [&] { return parser.parse(); });
+
+    if (!diagnostics.hadError) resolve(tree);
+    if (!diagnostics.hadError && unit->cache) stats.time(stats.cache, [&] { unit->cache->store(source, tree); });
+    if (!diagnostics.hadError) {
+      execute(tree);
+      retain(std::move(tree));
+    }
+    return report(parser.expressionNodes, parser.statementNodes);
+  }
+
+  // Each declaration is executed and dropped before the next one is parsed,
+  // unless it declares functions. Scanning happens on demand inside the
+  // parser, so its time is counted as parse time.
+  auto&& parser = Parser{.diagnostics = diagnostics, .scanner = &scanner};
+  while (auto&& tree = stats.time(stats.parse, [&] { return parser.next(); })) {
+    // After an error keep parsing and resolving so every static error is
+    // still reported, but run nothing more.
+    resolve(*tree);
+    if (diagnostics.hadError || diagnostics.hadRuntimeError) continue;
+
+    execute(*tree);
+    retain(std::move(*tree));
+  }
+  return report(parser.expressionNodes, parser.statementNodes);
+}
+}
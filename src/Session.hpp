@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Diagnostics.hpp"
+#include "Lox.hpp"
+#include "LoxCallable.hpp"
+#include "Native.hpp"
+#include "Object.hpp"
+#include "Stats.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace lox {
+// An independent Lox instance for embedding. Each Session owns its globals,
+// symbol table and engine and reports through its own sinks, so one process
+// can host many of them. Programs passed to run() execute one after another
+// against the same globals, like lines typed at the prompt.
+//
+// Sessions share no mutable state, and any number of them can run at once on
+// different threads as long as each Session (and every value taken out of
+// it) stays on one thread: values are reference counted without atomics and
+// strings are interned per thread. Only the profiler is process-wide, since
+// it is driven by SIGPROF; at most one Session at a time should set
+// Options::profile.
+struct Session {
+  enum class Result: std::uint8_t {
+    OK,
+    STATIC_ERROR,
+    RUNTIME_ERROR,
+  };
+
+  // How long the text passed to run() stays valid and unchanged.
+  enum class Lifetime: std::uint8_t {
+    // Only for the call. The tree walker can call back into a program's
+    // functions later, so it copies the text first.
+    CALL,
+    // At least as long as the Session, which then never copies it. Lets a
+    // mapped or streamed script run in place.
+    SESSION,
+  };
+
+  struct State;
+
+  std::unique_ptr<State> state;
+
+  explicit Session(Options options = {}, Sink output = fileSink(stdout), Sink errors = fileSink(stdout));
+
+  Session(Session&&) noexcept;
+  auto operator=(Session&&) noexcept -> Session&;
+  ~Session();
+
+  // Makes `value` the global `name`, as if a program had declared it.
+  auto defineGlobal(std::string_view name, Object value) -> void;
+
+  // Binds a C++ function or lambda as the global function `name`; see
+  // Native for the parameter and result types it may use. For example
+  // `session.defineNative("sqrt", static_cast<double (*)(double)>(std::sqrt))`.
+  template<typename F>
+  auto defineNative(std::string name, F function) -> void {
+    auto&& native = Native::bind(name, std::move(function));
+    defineGlobal(name, Object{Ref<LoxCallable>{std::move(native)}});
+  }
+
+  // Scans, parses, resolves and executes `source`.
+  auto run(std::string_view source, Lifetime lifetime = Lifetime::CALL) -> Result;
+
+  // What the Jit has done over every run so far; all zero unless the
+  // Session runs Engine::VM with Options::jit on a build that supports it.
+  auto jitStats() const -> JitStats;
+};
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace lox {
+// Script text loaded for scanning. Regular files are mapped read-only and
+// scanned in place; pipes, terminals and other non-regular files are read
+// into an owned buffer instead.
+struct SourceFile {
+  void* mapping = nullptr;
+  std::size_t size = {};
+  std::string buffer = {};
+
+  SourceFile() = default;
+
+  SourceFile(const SourceFile&) = delete;
+  auto operator=(const SourceFile&) -> SourceFile& = delete;
+
+  SourceFile(SourceFile&& other) noexcept:
+    mapping(std::exchange(other.mapping, nullptr)),
+    size(std::exchange(other.size, 0)),
+    buffer(std::move(other.buffer))
+  {}
+
+  auto operator=(SourceFile&& other) noexcept -> SourceFile& {
+    if (this != &other) {
+      unmap();
+      mapping = std::exchange(other.mapping, nullptr);
+      size = std::exchange(other.size, 0);
+      buffer = std::move(other.buffer);
+    }
+    return *this;
+  }
+
+  ~SourceFile() {
+    unmap();
+  }
+
+  static auto open(const char* path) -> std::optional<SourceFile> {
+    auto&& fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return {};
+
+    auto&& file = SourceFile{};
+    auto&& loaded = file.load(fd);
+    ::close(fd);
+
+    if (!loaded) return {};
+    return file;
+  }
+
+  auto view() const -> std::string_view {
+    if (mapping) return {static_cast<const char*>(mapping), size};
+    return buffer;
+  }
+
+  auto load(int fd) -> bool {
+    struct stat info = {};
+    if (::fstat(fd, &info) != 0) return false;
+
+    if (S_ISREG(info.st_mode)) {
+      size = static_cast<std::size_t>(info.st_size);
+      // A zero-length mapping is an error; an empty file is just empty.
+      if (size == 0) return true;
+
+      auto&& address = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (address != MAP_FAILED) {
+        ::madvise(address, size, MADV_SEQUENTIAL);
+        mapping = address;
+        return true;
+      }
+      size = 0;
+    }
+
+    return read(fd);
+  }
+
+  auto read(int fd) -> bool {
+    constexpr std::size_t CHUNK_SIZE = 64 * 1024;
+
+    for (;;) {
+      auto&& used = buffer.size();
+      buffer.resize(used + CHUNK_SIZE);
+
+      auto&& count = ::read(fd, buffer.data() + used, CHUNK_SIZE);
+      if (count < 0) return false;
+
+      buffer.resize(used + static_cast<std::size_t>(count));
+      if (count == 0) return true;
+    }
+  }
+
+  auto unmap() -> void {
+    if (mapping) ::munmap(mapping, size);
+    mapping = nullptr;
+  }
+};
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "Lox.hpp"
+#include "PerfCounters.hpp"
+
+#include <fmt/format.h>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <numeric>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace lox {
+// Counters kept by the engines while a program runs. They are bumped
+// unconditionally, since a plain increment is cheaper than testing whether
+// anyone will read them.
+struct Counters {
+  std::size_t statements = {};
+  std::size_t expressions = {};
+  std::size_t calls = {};
+  std::size_t environments = {};
+  std::size_t depth = {};
+  std::size_t peakDepth = {};
+
+  auto enter() -> void {
+    if (++depth > peakDepth) peakDepth = depth;
+  }
+
+  auto leave() -> void {
+    depth--;
+  }
+};
+
+// Work done by the cycle collector (see Heap).
+struct GcStats {
+  std::size_t minor = {};
+  std::size_t full = {};
+  std::size_t freedObjects = {};
+  std::size_t freedBytes = {};
+  std::chrono::steady_clock::duration pause = {};
+  std::chrono::steady_clock::duration maxPause = {};
+};
+
+// What the Jit did (see Vm::hot).
+struct JitStats {
+  std::size_t compiled = {};
+  std::size_t rejected = {};
+  std::size_t codeBytes = {};
+  std::size_t entries = {};
+  // How often compiled code handed each instruction back to the Vm, indexed
+  // by OpCode. Each kind of instruction has at most one guard, so this
+  // tells which guard fired.
+  std::array<std::size_t, 256> exits = {};
+};
+
+// What --stats and --perf-counters report for one run: wall time and
+// hardware counters per phase, scanner and parser output sizes and the
+// executing engine's counters.
+struct Stats {
+  using Clock = std::chrono::steady_clock;
+
+  struct Phase {
+    Clock::duration elapsed = {};
+    PerfCounters::Sample counters = {};
+  };
+
+  Phase scan = {};
+  Phase parse = {};
+  Phase cache = {};
+  Phase resolve = {};
+  Phase optimize = {};
+  Phase compile = {};
+  Phase execute = {};
+  std::size_t tokens = {};
+  std::size_t expressionNodes = {};
+  std::size_t statementNodes = {};
+  Counters counters = {};
+  GcStats gc = {};
+  JitStats jit = {};
+  // Hardware counters to attribute to each phase, when requested.
+  const PerfCounters* perf = {};
+
+  // Runs `region` and charges its wall time and counter deltas to `phase`.
+  template<typename F>
+  auto time(Phase& phase, F&& region) const -> decltype(region()) {
+    auto&& start = Clock::now();
+    auto&& before = perf ? perf->read() : PerfCounters::Reading{};
+    auto&& finish = [&] {
+      if (perf) phase.counters += PerfCounters::difference(perf->read(), before);
+      phase.elapsed += Clock::now() - start;
+    };
+
+    if constexpr (std::is_void_v<decltype(region())>) {
+      region();
+      finish();
+    } else {
+      decltype(auto) result = region();
+      finish();
+      return result;
+    }
+  }
+
+  auto report(const Options& options) const -> void {
+    using namespace fmt;
+    using namespace std::chrono;
+
+    auto&& ms = [](Clock::duration elapsed) { return duration<double, std::milli>(elapsed).count(); };
+
+    auto&& phases = std::vector<std::pair<std::string_view, Phase>>{};
+    if (options.stream) {
+      // The streaming parser scans on demand, so scanning is part of parse.
+      phases.emplace_back("scan+parse", parse);
+    } else {
+      phases.emplace_back("scan", scan);
+      phases.emplace_back("parse", parse);
+    }
+    if (!options.cache.empty()) phases.emplace_back("cache", cache);
+    phases.emplace_back("resolve", resolve);
+    if (options.optimize) phases.emplace_back("optimize", optimize);
+    if (options.engine != Engine::TREE) phases.emplace_back("compile", compile);
+    phases.emplace_back("execute", execute);
+
+    auto&& total = Phase{};
+    for (auto&& [name, phase]: phases) {
+      total.elapsed += phase.elapsed;
+      total.counters += phase.counters;
+    }
+    phases.emplace_back("total", total);
+
+    auto&& counting = perf && perf->available();
+
+    print(stderr, "-- stats --\n");
+    print(stderr, "{:<12}{:>12}", "phase", "ms");
+    if (counting) {
+      for (auto&& name: PerfCounters::NAMES) print(stderr, "{:>18}", name);
+    }
+    print(stderr, "\n");
+
+    for (auto&& [name, phase]: phases) {
+      print(stderr, "{:<12}{:>12.3f}", name, ms(phase.elapsed));
+      if (counting) {
+        for (std::size_t i = 0; i < PerfCounters::EVENT_COUNT; i++) {
+          if (phase.counters.valid[i]) {
+            print(stderr, "{:>18}", phase.counters.values[i]);
+          } else {
+            print(stderr, "{:>18}", "-");
+          }
+        }
+      }
+      print(stderr, "\n");
+    }
+
+    if (perf && !perf->unavailable.empty()) {
+      print(stderr, "perf counters unavailable ({})\n", perf->unavailable);
+    }
+
+    auto&& scanSeconds = duration<double>((options.stream ? parse : scan).elapsed).count();
+    print(stderr, "tokens                 {} ({:.0f} tokens/s)\n",
+      tokens, scanSeconds > 0 ? static_cast<double>(tokens) / scanSeconds : 0.0);
+    print(stderr, "nodes                  {} ({} expressions, {} statements)\n",
+      expressionNodes + statementNodes, expressionNodes, statementNodes);
+
+    if (options.engine == Engine::VM) {
+      print(stderr, "calls made             {}\n", counters.calls);
+      print(stderr, "peak call depth        {}\n", counters.peakDepth);
+      if (options.jit) {
+        print(stderr, "jit compiled           {} functions ({} rejected, {} bytes)\n", jit.compiled, jit.rejected, jit.codeBytes);
+        print(stderr, "jit entries            {}\n", jit.entries);
+        print(stderr, "jit exits              {}\n", std::accumulate(jit.exits.begin(), jit.exits.end(), std::size_t{}));
+      }
+    } else if (options.engine == Engine::CLOSURE) {
+      print(stderr, "calls made             {}\n", counters.calls);
+      print(stderr, "environments allocated {}\n", counters.environments);
+      print(stderr, "peak environment depth {}\n", counters.peakDepth);
+    } else {
+      print(stderr, "statements executed    {}\n", counters.statements);
+      print(stderr, "expressions evaluated  {}\n", counters.expressions);
+      print(stderr, "calls made             {}\n", counters.calls);
+      print(stderr, "environments allocated {}\n", counters.environments);
+      print(stderr, "peak environment depth {}\n", counters.peakDepth);
+    }
+    print(stderr, "gc collections         {} ({} minor, {} full)\n", gc.minor + gc.full, gc.minor, gc.full);
+    print(stderr, "gc pause               {:.3f} ms total, {:.3f} ms max\n", ms(gc.pause), ms(gc.maxPause));
+    print(stderr, "gc freed               {} objects, {} bytes\n", gc.freedObjects, gc.freedBytes);
+  }
+};
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace lox {
+// Dense integer id of an interned identifier.
+using Symbol = std::uint32_t;
+
+inline constexpr Symbol NO_SYMBOL = std::numeric_limits<Symbol>::max();
+
+// Interns identifier names so the rest of the pipeline can compare, hash
+// and index by Symbol. One table is shared by everything that runs a given
+// source, starting with the Scanner.
+struct SymbolTable {
+  // Keys view the strings in `names`; a deque never moves its elements.
+  std::unordered_map<std::string_view, Symbol> ids = {};
+  std::deque<std::string> names = {};
+
+  auto intern(std::string_view name) -> Symbol {
+    if (auto&& it = ids.find(name); it != ids.end()) return it->second;
+
+    auto&& symbol = static_cast<Symbol>(names.size());
+    ids.emplace(names.emplace_back(name), symbol);
+    return symbol;
+  }
+
+  auto name(Symbol symbol) const -> const std::string& {
+    return names[symbol];
+  }
+
+  auto size() const -> std::size_t {
+    return names.size();
+  }
+};
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace lox {
+// Runs a fixed set of independent tasks on a thread per core. Every worker
+// starts with a contiguous share of the task indices in a deque of its own
+// and takes from the back of it; once that runs dry it steals from the front
+// of another worker's, so a few slow tasks don't leave the other cores idle.
+// Tasks never add tasks, so a worker that finds every deque empty is done.
+struct ThreadPool {
+  struct Queue {
+    std::mutex mutex = {};
+    std::deque<std::size_t> tasks = {};
+  };
+
+  std::size_t workers = std::max(1U, std::thread::hardware_concurrency());
+
+  // Calls `task(i)` for every i below `count` and returns once all are done.
+  template<typename F>
+  auto run(std::size_t count, F&& task) const -> void {
+    using namespace std;
+
+    auto&& threads = min(workers, count);
+    if (threads == 0) return;
+
+    auto&& queues = vector<Queue>(threads);
+    for (size_t i = 0; i < count; i++) {
+      queues[i * threads / count].tasks.push_back(i);
+    }
+
+    auto&& pool = vector<jthread>{};
+    pool.reserve(threads);
+    for (size_t self = 0; self < threads; self++) {
+      pool.emplace_back([&queues, &task, self] {
+        while (auto&& index = take(queues, self)) task(*index);
+      });
+    }
+  }
+
+  static auto take(std::vector<Queue>& queues, std::size_t self) -> std::optional<std::size_t> {
+    using namespace std;
+
+    {
+      auto&& own = queues[self];
+      auto&& lock = scoped_lock{own.mutex};
+      if (!own.tasks.empty()) {
+        auto index = own.tasks.back();
+        own.tasks.pop_back();
+        return index;
+      }
+    }
+
+    for (size_t offset = 1; offset < queues.size(); offset++) {
+      auto&& victim = queues[(self + offset) % queues.size()];
+      auto&& lock = scoped_lock{victim.mutex};
+      if (!victim.tasks.empty()) {
+        auto index = victim.tasks.front();
+        victim.tasks.pop_front();
+        return index;
+      }
+    }
+
+    return {};
+  }
+};
+}
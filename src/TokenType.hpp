@@ -1,6 +1,6 @@
 #pragma once
 
-#include "Object.hpp"
+#include "Symbol.hpp"
 
 #include <fmt/core.h>
 #include <magic_enum.hpp>
@@ -8,6 +8,8 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include <variant>
 
 namespace lox {
 enum class TokenType: std::uint8_t {
@@ -60,11 +62,20 @@ enum class TokenType: std::uint8_t {
   LOX_EOF,
 };
 
+// The value of a NUMBER or STRING token; a string is the lexeme without its
+// quotes. The Parser turns it into an Object. Nothing in a Token owns memory,
+// so syntax tree nodes that hold one need no destructor.
+using TokenLiteral = std::variant<std::monostate, double, std::string_view>;
+
+// `lexeme` is a view into the scanned source buffer, which must stay alive
+// as long as any token or syntax tree built from it.
 struct Token {
   TokenType type = {};
-  std::string lexeme = {};
-  Object literal = {};
+  std::string_view lexeme = {};
+  TokenLiteral literal = {};
   std::size_t line = {};
+  // Interned name for IDENTIFIER tokens, NO_SYMBOL otherwise.
+  Symbol symbol = NO_SYMBOL;
 };
 }
 
@@ -79,7 +90,10 @@ struct formatter<lox::Token> {
   template<typename FormatContext>
   auto format(const lox::Token& token, FormatContext& ctx) const {
     using namespace magic_enum;
-    return format_to(ctx.out(), "{} {} {}", enum_name(token.type), token.lexeme, token.literal);
+    auto&& out = format_to(ctx.out(), "{} {} ", enum_name(token.type), token.lexeme);
+    if (auto* number = std::get_if<double>(&token.literal)) return format_to(out, "{}", *number);
+    if (auto* text = std::get_if<std::string_view>(&token.literal)) return format_to(out, "{}", *text);
+    return format_to(out, "nil");
   }
 };
 }
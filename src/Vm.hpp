@@ -0,0 +1,465 @@
+#pragma once
+
+#include "Chunk.hpp"
+#include "Compiler.hpp"
+#include "Diagnostics.hpp"
+#include "Heap.hpp"
+#include "Jit.hpp"
+#include "LoxCallable.hpp"
+#include "Native.hpp"
+#include "Object.hpp"
+#include "Profiler.hpp"
+#include "RuntimeError.hpp"
+#include "Stats.hpp"
+#include "TokenType.hpp"
+
+#include <fmt/format.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace lox {
+// Stack-based bytecode interpreter for Programs produced by the Compiler.
+// Runtime errors are raised as RuntimeError carrying the faulting line, the
+// same way the tree-walking Interpreter reports them.
+//
+// The frames and the value stack start small and grow when a call needs
+// room, up to FRAMES_MAX frames and STACK_MAX values, so the VM recurses at
+// least as deep as the tree walker does on a default thread stack.
+struct Vm {
+  static constexpr std::size_t FRAMES_MAX = 1 << 18;
+  static constexpr std::size_t STACK_MAX = FRAMES_MAX * 16;
+  static constexpr std::size_t INITIAL_FRAMES = 64;
+
+  struct CallFrame {
+    VmClosure* closure = {};
+    const std::uint8_t* ip = {};
+    Object* slots = {};
+  };
+
+  struct Global {
+    Object value = {};
+    bool defined = {};
+  };
+
+  Diagnostics& diagnostics;
+  // Where `print` writes.
+  Sink output = {};
+  std::vector<Object> stack = std::vector<Object>(INITIAL_FRAMES * VmFunction::FRAME_SLOTS);
+  Object* stackTop = stack.data();
+  Object* stackEnd = stack.data() + stack.size();
+  std::vector<CallFrame> frames = {};
+  std::vector<Global> globals = {};
+  std::vector<std::string> globalNames = {};
+  // Upvalues still pointing into the stack, ordered by stack address.
+  std::vector<std::shared_ptr<Upvalue>> openUpvalues = {};
+  Counters counters = {};
+  // Tracks closed-over upvalues, through which closures can reach themselves.
+  Heap heap = {};
+  Profiler* profiler = {};
+  // Compile hot functions with the Jit and run their machine code.
+  bool jit = false;
+  JitStats jitStats = {};
+
+  explicit Vm(Diagnostics& diagnostics, Sink output = fileSink(stdout)):
+    diagnostics(diagnostics),
+    output(std::move(output))
+  {
+    // Calls only allocate when they go deeper than any call before them:
+    // arguments are already on the stack, and the frames and stack keep
+    // whatever capacity they have grown to.
+    frames.reserve(INITIAL_FRAMES);
+  }
+
+  Vm(const Vm&) = delete;
+  auto operator=(const Vm&) -> Vm& = delete;
+
+  ~Vm() {
+    resetStack();
+    globals.clear();
+    heap.collect(true);
+  }
+
+  auto interpret(const Program& program) -> void {
+    using namespace std;
+
+    globalNames.insert(globalNames.end(), program.globals.begin(), program.globals.end());
+    // Natives may already have been given the next indices.
+    if (globals.size() < globalNames.size()) globals.resize(globalNames.size());
+
+    auto&& script = Ref<VmClosure>::make(program.script);
+    push(Ref<LoxCallable>{script});
+
+    try {
+      callClosure(script.get(), 0);
+      run();
+    } catch (const RuntimeError& err) {
+      diagnostics.runtimeError(err);
+      resetStack();
+      counters.depth = 0;
+    }
+  }
+
+  // Defines a global before any Program refers to it, as for natives.
+  auto define(std::uint16_t index, Object value) -> void {
+    if (index >= globals.size()) globals.resize(index + 1);
+    globals[index] = Global{std::move(value), true};
+  }
+
+  auto push(const Object& value) -> void {
+    if (stackTop == stackEnd) throw error("Stack overflow.");
+    *stackTop++ = value;
+  }
+
+  auto push(Object&& value) -> void {
+    if (stackTop == stackEnd) throw error("Stack overflow.");
+    *stackTop++ = std::move(value);
+  }
+
+  auto pop() -> Object {
+    return std::move(*--stackTop);
+  }
+
+  auto peek(std::size_t distance) -> Object& {
+    return stackTop[-1 - static_cast<std::ptrdiff_t>(distance)];
+  }
+
+  auto resetStack() -> void {
+    while (stackTop != stack.data()) {
+      *--stackTop = std::monostate{};
+    }
+    frames.clear();
+    openUpvalues.clear();
+  }
+
+  auto error(const std::string& message) -> RuntimeError {
+    auto&& frame = frames.back();
+    auto&& chunk = frame.closure->function->chunk;
+    auto&& offset = static_cast<std::size_t>(frame.ip - chunk.code.data() - 1);
+
+    return RuntimeError{Token{TokenType::LOX_EOF, "", {}, chunk.getLine(offset)}, message};
+  }
+
+  auto callValue(const Object& callee, std::uint8_t argCount) -> void {
+    using namespace std;
+
+    if (isCallable(callee)) {
+      auto* callable = &asCallable(callee);
+      if (typeid(*callable) == typeid(VmClosure)) return callClosure(static_cast<VmClosure*>(callable), argCount);
+      if (typeid(*callable) == typeid(Native)) return callNative(static_cast<const Native*>(callable), argCount);
+    }
+
+    throw error("Can only call functions and classes.");
+  }
+
+  // Natives run straight off the arguments on the stack; the callee and
+  // its arguments are then replaced by the result.
+  auto callNative(const Native* native, std::uint8_t argCount) -> void {
+    using namespace fmt;
+
+    if (argCount != native->parameters) {
+      throw error(format("Expected {} arguments but got {}.", native->parameters, argCount));
+    }
+
+    counters.calls++;
+    auto&& result = native->invoke(std::span<Object>{stackTop - argCount, argCount});
+    if (!result) throw error(result.error());
+
+    auto* base = stackTop - argCount - 1;
+    while (stackTop != base) pop();
+    push(std::move(*result));
+  }
+
+  auto callClosure(VmClosure* closure, std::uint8_t argCount) -> void {
+    using namespace fmt;
+
+    if (argCount != closure->function->arity) {
+      throw error(format("Expected {} arguments but got {}.", closure->function->arity, argCount));
+    }
+
+    if (frames.size() == FRAMES_MAX) {
+      throw error("Stack overflow.");
+    }
+
+    auto* slots = stackTop - argCount - 1;
+    if (stackEnd - slots < static_cast<std::ptrdiff_t>(VmFunction::FRAME_SLOTS)) {
+      slots = grow(slots);
+    }
+
+    frames.push_back(CallFrame{closure, closure->function->chunk.code.data(), slots});
+    counters.calls++;
+    counters.enter();
+  }
+
+  // Reallocates the stack with room for another frame starting at `slots`
+  // and moves every pointer into it along. Only called between
+  // instructions, when no other pointers into the stack are held.
+  auto grow(Object* slots) -> Object* {
+    auto* old = stack.data();
+    auto&& size = 2 * stack.size();
+    if (size > STACK_MAX) throw error("Stack overflow.");
+
+    stack.resize(size);
+    auto&& rebase = [&](Object* pointer) { return stack.data() + (pointer - old); };
+    for (auto&& frame: frames) frame.slots = rebase(frame.slots);
+    for (auto&& upvalue: openUpvalues) upvalue->location = rebase(upvalue->location);
+    stackTop = rebase(stackTop);
+    stackEnd = stack.data() + stack.size();
+    return rebase(slots);
+  }
+
+  // Counts a call or loop iteration of `function` and compiles it when it
+  // becomes hot. Functions the Jit rejects keep being interpreted.
+  auto hot(VmFunction& function) -> void {
+    if (function.jit || ++function.hotness != Jit::HOT_THRESHOLD) return;
+
+    function.jit = Jit::compile(function, Jit::Helpers{&getGlobal, &setGlobal});
+    if (function.jit) {
+      jitStats.compiled++;
+      jitStats.codeBytes += function.jit->size;
+    } else {
+      jitStats.rejected++;
+    }
+  }
+
+  // Global access for compiled code; undefined globals are left to run() so
+  // that it raises the error.
+  static auto getGlobal(void* vm, std::uint32_t index, Object* slot) -> bool {
+    auto&& global = static_cast<Vm*>(vm)->globals[index];
+    if (!global.defined) return false;
+    *slot = global.value;
+    return true;
+  }
+
+  static auto setGlobal(void* vm, std::uint32_t index, Object* slot) -> bool {
+    auto&& global = static_cast<Vm*>(vm)->globals[index];
+    if (!global.defined) return false;
+    global.value = *slot;
+    return true;
+  }
+
+  // Hands the profiler the current call stack. Every frame's ip must be
+  // up to date.
+  auto sample() -> void {
+    using namespace std;
+
+    auto&& stack = vector<Profiler::Location>{};
+    for (size_t i = 0; i < frames.size(); i++) {
+      auto&& function = *frames[i].closure->function;
+      auto&& offset = static_cast<size_t>(frames[i].ip - function.chunk.code.data() - 1);
+      auto&& name = i == 0 ? string_view{"<script>"} : string_view{function.name};
+      stack.push_back(Profiler::Location{name, function.chunk.getLine(offset)});
+    }
+    profiler->record(stack);
+  }
+
+  auto captureUpvalue(Object* local) -> std::shared_ptr<Upvalue> {
+    using namespace std;
+
+    auto&& it = openUpvalues.end();
+    while (it != openUpvalues.begin() && (*prev(it))->location > local) --it;
+    if (it != openUpvalues.begin() && (*prev(it))->location == local) return *prev(it);
+
+    auto&& created = make_shared<Upvalue>(Upvalue{local, {}});
+    openUpvalues.insert(it, created);
+    heap.track(created);
+    return created;
+  }
+
+  auto closeUpvalues(Object* last) -> void {
+    while (!openUpvalues.empty() && openUpvalues.back()->location >= last) {
+      auto&& upvalue = openUpvalues.back();
+      upvalue->closed = std::move(*upvalue->location);
+      upvalue->location = &upvalue->closed;
+      openUpvalues.pop_back();
+    }
+  }
+
+  auto run() -> void {
+    using enum OpCode;
+    using namespace std;
+
+    auto* frame = &frames.back();
+    auto* ip = frame->ip;
+    auto* constants = frame->closure->function->chunk.constants.data();
+
+    auto readByte = [&ip]() { return *ip++; };
+    auto readShort = [&ip]() {
+      ip += 2;
+      return static_cast<uint16_t>((ip[-2] << 8) | ip[-1]);
+    };
+    // The frame's ip is only written back when something may need it: calls,
+    // returns and errors.
+    auto fail = [this, &frame, &ip](const std::string& message) {
+      frame->ip = ip;
+      return error(message);
+    };
+    auto numbers = [this, &fail]() -> std::pair<double, double> {
+      if (!isNumber(peek(1)) || !isNumber(peek(0))) throw fail("Operands must be numbers.");
+      return {asNumber(peek(1)), asNumber(peek(0))};
+    };
+    // Binary operators overwrite their left operand in place. Assigning the
+    // raw result (rather than a temporary Object) lets a slot that already
+    // holds the same kind of value be updated without a type switch.
+    auto replace = [this](auto value) {
+      --stackTop;
+      stackTop[-1] = std::move(value);
+    };
+    // Runs the current frame's machine code from ip, if it has any, and
+    // carries on interpreting wherever that code stopped.
+    auto enter = [this, &frame, &ip] {
+      auto&& function = *frame->closure->function;
+      auto* code = function.chunk.code.data();
+      auto&& offset = static_cast<size_t>(ip - code);
+      if (!function.jit || !function.jit->enterable(offset)) return;
+
+      jitStats.entries++;
+      auto&& exit = function.jit->run(frame->slots, this, offset);
+      jitStats.exits[code[exit]]++;
+      ip = code + exit;
+      stackTop = frame->slots + function.jit->depths[exit];
+    };
+
+    for (;;) {
+      switch (static_cast<OpCode>(readByte())) {
+        case CONSTANT: push(constants[readShort()]); break;
+        case NIL: push(std::monostate{}); break;
+        case TRUE: push(true); break;
+        case FALSE: push(false); break;
+        case POP: pop(); break;
+        case GET_LOCAL: push(frame->slots[readByte()]); break;
+        case SET_LOCAL: frame->slots[readByte()] = peek(0); break;
+        case GET_GLOBAL: {
+          auto&& index = readShort();
+          auto&& global = globals[index];
+          if (!global.defined) throw fail(fmt::format("Undefined variable '{}'.", globalNames[index]));
+          push(global.value);
+          break;
+        }
+        case DEFINE_GLOBAL: {
+          auto&& global = globals[readShort()];
+          global.value = pop();
+          global.defined = true;
+          break;
+        }
+        case SET_GLOBAL: {
+          auto&& index = readShort();
+          auto&& global = globals[index];
+          if (!global.defined) throw fail(fmt::format("Undefined variable {}.", globalNames[index]));
+          global.value = peek(0);
+          break;
+        }
+        case GET_UPVALUE: push(*frame->closure->upvalues[readByte()]->location); break;
+        case SET_UPVALUE: *frame->closure->upvalues[readByte()]->location = peek(0); break;
+        case EQUAL: replace(isEqual(peek(1), peek(0))); break;
+        case NOT_EQUAL: replace(!isEqual(peek(1), peek(0))); break;
+        case GREATER: { auto&& [a, b] = numbers(); replace(a > b); break; }
+        case GREATER_EQUAL: { auto&& [a, b] = numbers(); replace(a >= b); break; }
+        case LESS: { auto&& [a, b] = numbers(); replace(a < b); break; }
+        case LESS_EQUAL: { auto&& [a, b] = numbers(); replace(a <= b); break; }
+        case ADD: {
+          if (isNumber(peek(1)) && isNumber(peek(0))) {
+            replace(asNumber(peek(1)) + asNumber(peek(0)));
+          } else if (isString(peek(1)) && isString(peek(0))) {
+            replace(LoxString::concat(asLoxString(peek(1)), asLoxString(peek(0))));
+          } else {
+            throw fail("Operands must be two numbers or two strings");
+          }
+          break;
+        }
+        case SUBTRACT: { auto&& [a, b] = numbers(); replace(a - b); break; }
+        case MULTIPLY: { auto&& [a, b] = numbers(); replace(a * b); break; }
+        case DIVIDE: { auto&& [a, b] = numbers(); replace(a / b); break; }
+        case NOT: peek(0) = !isTruthy(peek(0)); break;
+        case NEGATE: {
+          if (!isNumber(peek(0))) throw fail("Operand must be a number.");
+          peek(0) = -asNumber(peek(0));
+          break;
+        }
+        case PRINT: emit(output, "{}\n", pop()); break;
+        case JUMP: {
+          auto&& offset = readShort();
+          ip += offset;
+          break;
+        }
+        case JUMP_IF_FALSE: {
+          auto&& offset = readShort();
+          if (!isTruthy(peek(0))) ip += offset;
+          break;
+        }
+        case LOOP: {
+          auto&& offset = readShort();
+          if (Profiler::pending && profiler) {
+            frame->ip = ip;
+            sample();
+          }
+          ip -= offset;
+          if (jit) {
+            hot(*frame->closure->function);
+            enter();
+          }
+          break;
+        }
+        case CALL: {
+          auto&& argCount = readByte();
+          frame->ip = ip;
+          if (Profiler::pending && profiler) sample();
+          callValue(peek(argCount), argCount);
+          frame = &frames.back();
+          ip = frame->ip;
+          constants = frame->closure->function->chunk.constants.data();
+          if (jit) {
+            hot(*frame->closure->function);
+            enter();
+          }
+          break;
+        }
+        case CLOSURE: {
+          auto&& function = frame->closure->function->chunk.functions[readShort()];
+          auto&& closure = Ref<VmClosure>::make(function);
+          for (auto&& upvalue: closure->upvalues) {
+            auto&& isLocal = readByte();
+            auto&& index = readByte();
+            upvalue = isLocal ? captureUpvalue(frame->slots + index) : frame->closure->upvalues[index];
+          }
+          push(Ref<LoxCallable>{std::move(closure)});
+          break;
+        }
+        case CLOSE_UPVALUE:
+          closeUpvalues(stackTop - 1);
+          pop();
+          break;
+        case RETURN: {
+          if (Profiler::pending && profiler) {
+            frame->ip = ip;
+            sample();
+          }
+          auto&& result = pop();
+          closeUpvalues(frame->slots);
+
+          auto* base = frame->slots;
+          frames.pop_back();
+          counters.leave();
+          while (stackTop != base) pop();
+
+          if (frames.empty()) return;
+
+          push(std::move(result));
+          frame = &frames.back();
+          ip = frame->ip;
+          constants = frame->closure->function->chunk.constants.data();
+          if (jit) enter();
+          break;
+        }
+      }
+    }
+  }
+};
+}
@@ -2,16 +2,69 @@
 
 #include <fmt/core.h>
 
+#include <string>
+#include <string_view>
+
 auto main(int argc, char** argv) -> int {
   using namespace fmt;
 
-  if (argc > 2) {
-    print("Usage: cxx-lox [script]\n");
-  } else if (argc == 2) {
-    lox::runFile(argv[1]);
+  auto&& options = lox::Options{};
+  auto&& batch = std::string{};
+  auto&& args = 1;
+  for (; args < argc && std::string_view{argv[args]}.starts_with("--"); args++) {
+    auto&& option = std::string_view{argv[args]};
+    if (option == "--engine=vm") {
+      options.engine = lox::Engine::VM;
+    } else if (option == "--engine=tree") {
+      options.engine = lox::Engine::TREE;
+    } else if (option == "--engine=closure") {
+      options.engine = lox::Engine::CLOSURE;
+    } else if (option == "--stream") {
+      options.stream = true;
+    } else if (option == "--no-optimize") {
+      options.optimize = false;
+    } else if (option == "--jit") {
+      options.jit = true;
+    } else if (option == "--stats") {
+      options.stats = true;
+    } else if (option == "--perf-counters") {
+      options.perfCounters = true;
+    } else if (option.starts_with("--profile=")) {
+      options.profile = option.substr(10);
+    } else if (option.starts_with("--cache=")) {
+      options.cache = option.substr(8);
+    } else if (option.starts_with("--emit-cpp=")) {
+      options.emitCpp = option.substr(11);
+    } else if (option.starts_with("--batch=")) {
+      batch = option.substr(8);
+    } else if (option == "--batch" && args + 1 < argc) {
+      batch = argv[++args];
+    } else {
+      print("Unknown option: {}\n", option);
+      return 64;
+    }
+  }
+
+  if (options.jit && options.engine != lox::Engine::VM) {
+    print(stderr, "--jit compiles bytecode; it needs --engine=vm.\n");
+    return 64;
+  }
+  if (options.jit && !lox::jitSupported()) {
+    print(stderr, "--jit is not supported by this build; interpreting instead.\n");
+    options.jit = false;
+  }
+
+  if (argc - args > 1 || (!batch.empty() && argc - args > 0) || (!options.emitCpp.empty() && argc - args != 1)) {
+    print("Usage: cxx-lox [--engine=tree|vm|closure] [--stream] [--no-optimize] [--jit] [--stats] [--perf-counters] [--profile=file] [--cache=dir] [--emit-cpp=file] [--batch dir|listfile | script]\n");
+  } else if (!batch.empty()) {
+    lox::runBatch(batch, options);
+  } else if (!options.emitCpp.empty()) {
+    lox::emitCpp(argv[args], options);
+  } else if (argc - args == 1) {
+    lox::runFile(argv[args], options);
   } else {
-    lox::runPrompt();
+    lox::runPrompt(options);
   }
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,83 @@
+#include "Lox.hpp"
+#include "Session.hpp"
+
+#include <fmt/format.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <utility>
+
+// Checks that calls in steady state do not allocate: once a program has run
+// deep enough to size the argument stack and environment pool, running more
+// calls must not cost more heap allocations. fib(20) makes about ten times
+// as many calls as fib(15), so any per-call allocation shows up as thousands
+// of extra allocations while the fixed cost of run() cancels out.
+
+namespace {
+std::size_t allocations = 0;
+}
+
+auto operator new(std::size_t size) -> void* {
+  allocations++;
+  if (auto* memory = std::malloc(size == 0 ? 1 : size)) return memory;
+  throw std::bad_alloc{};
+}
+
+// Kept out of line: once inlined, GCC pairs the free() with the operator new
+// call at the allocation site and warns about a mismatch.
+[[gnu::noinline]] auto operator delete(void* memory) noexcept -> void {
+  std::free(memory);
+}
+
+[[gnu::noinline]] auto operator delete(void* memory, std::size_t) noexcept -> void {
+  std::free(memory);
+}
+
+namespace {
+// Two runs of the same size still differ by a handful of allocations, such
+// as the number literals interned by the scanner. Per-call allocations
+// would add thousands.
+constexpr std::size_t TOLERANCE = 32;
+
+auto allocationsFor(lox::Session& session, std::string_view source) -> std::size_t {
+  auto before = allocations;
+  if (session.run(source) != lox::Session::Result::OK) {
+    fmt::print(stderr, "failed to run {:?}\n", source);
+    std::exit(1);
+  }
+  return allocations - before;
+}
+
+// Returns whether `engine` passed.
+auto check(std::string_view name, lox::Engine engine) -> bool {
+  auto&& options = lox::Options{};
+  options.engine = engine;
+  auto&& discard = [](std::string_view) {};
+  auto&& session = lox::Session{std::move(options), discard, discard};
+
+  allocationsFor(session, "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }");
+  // Warms up to the deepest recursion measured below.
+  allocationsFor(session, "fib(20);");
+
+  auto&& fewer = allocationsFor(session, "fib(15);");
+  auto&& more = allocationsFor(session, "fib(20);");
+  auto&& passed = more <= fewer + TOLERANCE;
+  fmt::print("{:<8} fib(15) {:>6} allocations, fib(20) {:>6} allocations: {}\n",
+    name, fewer, more, passed ? "ok" : "FAILED");
+  return passed;
+}
+}
+
+auto main() -> int {
+  using enum lox::Engine;
+
+  auto&& passed = true;
+  for (auto&& [name, engine]: std::array{std::pair{"tree", TREE}, std::pair{"closure", CLOSURE}, std::pair{"vm", VM}}) {
+    passed = check(name, engine) && passed;
+  }
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+# Runs SCRIPT on the interpreter at LOX and runs PROGRAM, the C++ that
+# --emit-cpp wrote for it, and fails unless both print, report and exit the
+# same. Used with cmake -P by the emit-cpp tests.
+execute_process(
+    COMMAND ${LOX} ${SCRIPT}
+    OUTPUT_VARIABLE expected_output
+    ERROR_VARIABLE expected_errors
+    RESULT_VARIABLE expected_result
+)
+execute_process(
+    COMMAND ${PROGRAM}
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE errors
+    RESULT_VARIABLE result
+)
+
+foreach(stream output errors result)
+    if(NOT "${${stream}}" STREQUAL "${expected_${stream}}")
+        message(FATAL_ERROR "${SCRIPT}: ${stream} differs\nexpected: ${expected_${stream}}\ngot:      ${${stream}}")
+    endif()
+endforeach()
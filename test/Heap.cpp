@@ -0,0 +1,65 @@
+#include "Environment.hpp"
+#include "Heap.hpp"
+#include "Run.hpp"
+
+#include <fmt/format.h>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Checks the cycle collector directly: garbage in a cycle is freed, objects
+// held from outside survive into the old generation, and the generations do
+// not keep entries of objects that reference counting already freed.
+
+namespace {
+using lox::test::check;
+
+// An environment that is its own enclosing one, the smallest cycle.
+auto cycle() -> std::shared_ptr<lox::Environment> {
+  auto&& environment = std::make_shared<lox::Environment>();
+  environment->enclosing = environment;
+  return environment;
+}
+}
+
+auto main() -> int {
+  {
+    auto&& heap = lox::Heap{};
+    auto&& garbage = std::weak_ptr{cycle()};
+    heap.track(garbage.lock());
+    auto&& held = cycle();
+    heap.track(held);
+    heap.collect(false);
+    check("cycle is freed", garbage.expired());
+    check("held cycle survives", held->enclosing == held);
+    check("survivor moves to old", heap.environments.young.empty() && heap.environments.old.size() == 1);
+    check("freed object is counted", heap.stats.freedObjects == 1, fmt::format("{} freed", heap.stats.freedObjects));
+    held->enclosing.reset();
+  }
+
+  {
+    auto&& heap = lox::Heap{};
+    for (auto i = 0; i < 100000; i++) heap.track(std::make_shared<lox::Environment>());
+    auto&& young = heap.environments.young.size();
+    check("dead young entries are dropped", young <= 1, fmt::format("{} entries", young));
+    check("dead objects do not trigger collections", heap.stats.minor == 0, fmt::format("{} collections", heap.stats.minor));
+  }
+
+  {
+    // Survivors die after they reach the old generation.
+    auto&& heap = lox::Heap{};
+    for (auto round = 0; round < 100; round++) {
+      auto&& live = std::vector<std::shared_ptr<lox::Environment>>(100);
+      for (auto&& environment: live) {
+        environment = std::make_shared<lox::Environment>();
+        heap.track(environment);
+      }
+      heap.collect(false);
+    }
+    auto&& old = heap.environments.old.size();
+    check("dead old entries are dropped", old <= 200, fmt::format("{} entries", old));
+  }
+
+  return lox::test::status();
+}
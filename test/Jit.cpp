@@ -0,0 +1,233 @@
+#include "Chunk.hpp"
+#include "Lox.hpp"
+#include "Run.hpp"
+#include "Session.hpp"
+#include "Stats.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Checks that compiled code behaves exactly like the tree walker: the
+// scripts in bench/ and example/, then one script per guard, each of which
+// has to hand its instruction back to the Vm. The scripts run their loop in a
+// function, so the loop compiles with locals, and feed it the value the
+// guard is there for only after it is hot. Built with the NaN-boxed layout,
+// which the Jit needs.
+
+namespace {
+using lox::test::check;
+using lox::test::Run;
+using enum lox::OpCode;
+
+struct Case {
+  std::string_view name;
+  std::string_view source;
+  // The instruction the guard hands back.
+  lox::OpCode exit;
+};
+
+constexpr auto GUARDS = std::array{
+  Case{"adding strings", R"(
+    fun run() {
+      var text = "";
+      for (var i = 0; i < 3000; i = i + 1) text = (i < 2000 and i or "x") + (i < 2000 and 1 or "y");
+      print text;
+    }
+    run();
+  )", ADD},
+  Case{"adding a string to a number", R"(
+    fun run() {
+      var sum = 0;
+      for (var i = 0; i < 3000; i = i + 1) sum = sum + (i == 2500 and "s" or i);
+    }
+    run();
+  )", ADD},
+  Case{"negating a string", R"(
+    fun run() {
+      var sum = 0;
+      for (var i = 0; i < 3000; i = i + 1) sum = sum + -(i == 2500 and "s" or i);
+    }
+    run();
+  )", NEGATE},
+  Case{"comparing a string", R"(
+    fun run() {
+      var count = 0;
+      for (var i = 0; i < 3000; i = i + 1) if ((i == 2500 and "s" or i) < 3000) count = count + 1;
+    }
+    run();
+  )", LESS},
+  Case{"strings equal", R"(
+    fun run() {
+      var value = "s";
+      var same = 0;
+      for (var i = 0; i < 3000; i = i + 1) if (value == "s") same = same + 1;
+      print same;
+    }
+    run();
+  )", EQUAL},
+  Case{"not of a string", R"(
+    fun run() {
+      var value = "s";
+      var falsey = 0;
+      for (var i = 0; i < 3000; i = i + 1) if (!value) falsey = falsey + 1;
+      print falsey;
+    }
+    run();
+  )", NOT},
+  Case{"popping a string", R"(
+    fun run() {
+      var text = "s";
+      for (var i = 0; i < 3000; i = i + 1) text;
+      print text;
+    }
+    run();
+  )", POP},
+  Case{"overwriting a string local", R"(
+    fun run() {
+      var value = "s";
+      var sum = 0;
+      for (var i = 0; i < 3000; i = i + 1) {
+        value = i;
+        sum = sum + value;
+        value = "s";
+      }
+      print sum;
+    }
+    run();
+  )", SET_LOCAL},
+  // The concatenation leaves its right operand above the top, where the
+  // condition's constant is pushed next time round.
+  Case{"pushing over a string", R"(
+    fun run() {
+      var a = "a";
+      var i = 0;
+      while (i < 3000) {
+        i = i + 1;
+        var text = a + a;
+      }
+      print i;
+    }
+    run();
+  )", CONSTANT},
+  Case{"undefined global read", R"(
+    fun run() {
+      var count = 0;
+      for (var i = 0; i < 3000; i = i + 1) if (i == 2500) count = count + missing;
+    }
+    run();
+  )", GET_GLOBAL},
+  Case{"undefined global assignment", R"(
+    fun run() {
+      for (var i = 0; i < 3000; i = i + 1) if (i == 2500) missing = i;
+    }
+    run();
+  )", SET_GLOBAL},
+  Case{"calls", R"(
+    fun counter() {
+      var count = 0;
+      fun increment() {
+        count = count + 1;
+        return count;
+      }
+      return increment;
+    }
+    fun run() {
+      var increment = counter();
+      var total = 0;
+      for (var i = 0; i < 3000; i = i + 1) total = total + increment();
+      print total;
+    }
+    run();
+  )", CALL},
+  Case{"nan", R"(
+    fun run() {
+      var nans = 0;
+      for (var i = 0; i < 3000; i = i + 1) {
+        var x = i / 0 - i / 0;
+        if (x != x) nans = nans + 1;
+        if (i == 2999) print -x;
+      }
+      print nans;
+    }
+    run();
+  )", PRINT},
+};
+
+struct Result {
+  Run run;
+  lox::JitStats stats;
+};
+
+auto jit(std::string_view source, std::string profile = {}) -> Result {
+  auto&& options = lox::Options{};
+  options.engine = lox::Engine::VM;
+  options.jit = true;
+  options.profile = std::move(profile);
+
+  auto&& result = Result{};
+  auto&& session = lox::Session{
+    std::move(options),
+    [&](std::string_view text) { result.run.output += text; },
+    [&](std::string_view text) { result.run.errors += text; },
+  };
+  result.run.result = session.run(source);
+  result.stats = session.jitStats();
+  return result;
+}
+
+auto read(const std::filesystem::path& path) -> std::string {
+  auto&& file = std::ifstream{path, std::ios::binary};
+  return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+auto scripts(const std::filesystem::path& directory) -> std::vector<std::filesystem::path> {
+  auto&& paths = std::vector<std::filesystem::path>{};
+  for (auto&& entry: std::filesystem::directory_iterator{directory}) {
+    if (entry.path().extension() == ".lox") paths.push_back(entry.path());
+  }
+  std::ranges::sort(paths);
+  return paths;
+}
+}
+
+auto main() -> int {
+  using lox::test::capture;
+
+  if (!lox::jitSupported()) {
+    fmt::print("the Jit is not supported by this build\n");
+    return 77;
+  }
+
+  for (auto&& directory: {LOX_BENCH_DIR, LOX_EXAMPLE_DIR}) {
+    for (auto&& path: scripts(directory)) {
+      auto&& source = read(path);
+      check(path.filename().string(), jit(source).run, capture(source));
+    }
+  }
+
+  for (auto&& [name, source, exit]: GUARDS) {
+    auto&& [run, stats] = jit(source);
+    check(name, run, capture(source));
+    check(fmt::format("{} compiles", name), stats.compiled > 0);
+    auto&& exits = stats.exits[static_cast<std::size_t>(exit)];
+    check(fmt::format("{} exits", name), exits > 0, fmt::format("no exits at {}", static_cast<int>(exit)));
+  }
+
+  // A pending profiler tick also sends a back-edge to the Vm.
+  auto&& profile = (std::filesystem::temp_directory_path() / "lox-test-jit.folded").string();
+  auto&& loop = "var sum = 0; for (var i = 0; i < 3000000; i = i + 1) sum = sum + i; print sum;";
+  check("profiler tick", jit(loop, profile).run, capture(loop));
+  std::filesystem::remove(profile);
+
+  return lox::test::status();
+}
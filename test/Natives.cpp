@@ -0,0 +1,102 @@
+#include "Lox.hpp"
+#include "Object.hpp"
+#include "Run.hpp"
+#include "Session.hpp"
+
+#include <fmt/format.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Checks the adapters Native::bind() generates: how each parameter type
+// converts its argument, how each result type is boxed, the errors for
+// arguments that do not convert, and that exceptions from the bound
+// function become runtime errors. Every case runs on every engine.
+
+namespace {
+using lox::test::check;
+using lox::test::Run;
+
+struct Case {
+  std::string_view name;
+  std::string_view source;
+  // Printed output, or the runtime error's message.
+  std::string_view expected;
+  bool fails = false;
+};
+
+constexpr auto CASES = std::array{
+  Case{"double parameter and result", "print half(3);", "1.5"},
+  Case{"int parameter", "print twice(21);", "42"},
+  Case{"int truncates", "print twice(-2.9);", "-4"},
+  Case{"int at its limits", "print twice(-2147483648.5) < 0 and twice(2147483647.5) > 0;", "true"},
+  Case{"int from a string", "twice(\"2\");", "Argument 1 to 'twice' must be a number.", true},
+  Case{"int from nan", "twice(0 / 0);", "Argument 1 to 'twice' must be a number from -2147483648 to 2147483647.", true},
+  Case{"int from infinity", "twice(1 / 0);", "Argument 1 to 'twice' must be a number from -2147483648 to 2147483647.", true},
+  Case{"int above its range", "twice(2147483648);", "Argument 1 to 'twice' must be a number from -2147483648 to 2147483647.", true},
+  Case{"unsigned below its range", "byte(-1);", "Argument 1 to 'byte' must be a number from 0 to 255.", true},
+  Case{"unsigned at its limit", "print byte(255.9);", "255"},
+  Case{"64-bit above its range", "wide(9223372036854775808);", "Argument 1 to 'wide' must be a number from -9223372036854775808 to 9223372036854775807.", true},
+  Case{"bool parameter", "print negate(false);", "true"},
+  Case{"bool from a number", "negate(0);", "Argument 1 to 'negate' must be a boolean.", true},
+  Case{"string_view parameter", "print length(\"four\");", "4"},
+  Case{"string parameter and result", "print shout(\"hi\");", "hi!"},
+  Case{"string from nil", "shout(nil);", "Argument 1 to 'shout' must be a string.", true},
+  Case{"const char* result", "print greeting();", "hello"},
+  Case{"void result", "print nothing(1);", "nil"},
+  Case{"Object parameter and result", "print identity(\"a\") + identity(\"b\");", "ab"},
+  Case{"first bad argument is reported", "between(\"a\", nil, 3);", "Argument 1 to 'between' must be a number.", true},
+  Case{"later bad argument is reported", "between(1, 2, nil);", "Argument 3 to 'between' must be a number.", true},
+  Case{"wrong argument count", "half(1, 2);", "Expected 1 arguments but got 2.", true},
+  Case{"exception", "thrower(1);", "Error in 'thrower': odd argument", true},
+  Case{"exception not thrown", "print thrower(2);", "2"},
+  Case{"unknown exception", "opaque();", "Error in 'opaque'.", true},
+};
+
+auto define(lox::Session& session) -> void {
+  session.defineNative("half", [](double x) { return x / 2; });
+  session.defineNative("twice", [](int x) { return 2.0 * x; });
+  session.defineNative("byte", [](std::uint8_t x) { return x; });
+  session.defineNative("wide", [](std::int64_t x) { return x; });
+  session.defineNative("negate", [](bool x) { return !x; });
+  session.defineNative("length", [](std::string_view x) { return x.size(); });
+  session.defineNative("shout", [](const std::string& x) { return x + "!"; });
+  session.defineNative("greeting", [] { return "hello"; });
+  session.defineNative("nothing", [](double) {});
+  session.defineNative("identity", [](const lox::Object& x) { return x; });
+  session.defineNative("between", [](double x, double low, double high) { return low <= x && x <= high; });
+  session.defineNative("thrower", [](int x) {
+    if (x % 2 != 0) throw std::invalid_argument{"odd argument"};
+    return x;
+  });
+  session.defineNative("opaque", [] -> double { throw 1; });
+}
+
+auto options(lox::Engine engine) -> lox::Options {
+  auto&& options = lox::Options{};
+  options.engine = engine;
+  return options;
+}
+}
+
+auto main() -> int {
+  using enum lox::Engine;
+  using enum lox::Session::Result;
+
+  for (auto&& [engineName, engine]: std::array{std::pair{"tree", TREE}, std::pair{"closure", CLOSURE}, std::pair{"vm", VM}}) {
+    for (auto&& [name, source, expected, fails]: CASES) {
+      auto&& run = lox::test::capture(source, options(engine), define);
+      auto&& wanted = fails
+        ? Run{"", fmt::format("{} \n[line 1 ]", expected), RUNTIME_ERROR}
+        : Run{fmt::format("{}\n", expected), "", OK};
+      check(fmt::format("{}: {}", engineName, name), run, wanted);
+    }
+  }
+
+  return lox::test::status();
+}
@@ -0,0 +1,162 @@
+#include "Ast.hpp"
+#include "Diagnostics.hpp"
+#include "Lox.hpp"
+#include "Optimizer.hpp"
+#include "Parser.hpp"
+#include "Resolver.hpp"
+#include "Run.hpp"
+#include "Scanner.hpp"
+#include "Session.hpp"
+#include "Symbol.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Checks what the Optimizer folds: constant expressions become the literal
+// the interpreter would compute, operations that would raise a runtime error
+// are left in place, and dead branches and loops are removed. Then checks
+// that every script prints and reports the same with and without
+// --no-optimize on every engine.
+
+namespace {
+using lox::test::check;
+using lox::test::Run;
+
+struct Folded {
+  std::string_view expression;
+  std::string_view value;
+};
+
+constexpr auto FOLDED = std::array{
+  Folded{"1 + 2 * 3", "7"},
+  Folded{"(1 + 2) * 3", "9"},
+  Folded{"10 - 4 / 2", "8"},
+  Folded{"\"a\" + \"b\"", "ab"},
+  Folded{"1 < 2", "true"},
+  Folded{"2 <= 1", "false"},
+  Folded{"1 == \"1\"", "false"},
+  Folded{"nil != false", "true"},
+  Folded{"!nil", "true"},
+  Folded{"-(2 + 1)", "-3"},
+  Folded{"nil or 3", "3"},
+  Folded{"1 and \"x\"", "x"},
+  Folded{"false and missing", "false"},
+};
+
+// Each would raise a runtime error, so it has to stay for the error to be
+// raised when it runs.
+constexpr auto UNFOLDED = std::array<std::string_view, 9>{
+  "-\"s\"",
+  "-nil",
+  "1 + \"a\"",
+  "1 + nil",
+  "\"a\" - \"b\"",
+  "\"a\" < 1",
+  "true * 2",
+  "-(\"a\" + \"b\")",
+  "1 + (2 + \"a\")",
+};
+
+// Parses, resolves and optimizes `source`.
+auto optimize(const std::string& source) -> lox::SyntaxTree {
+  auto&& symbols = lox::SymbolTable{};
+  auto&& diagnostics = lox::Diagnostics{};
+  auto&& tokens = lox::Scanner{source, symbols, diagnostics}.scanTokens();
+  auto&& tree = lox::Parser{diagnostics, tokens}.parse();
+  lox::Resolver{diagnostics}.resolve(tree.statements);
+  lox::Optimizer{*tree.arena}.optimize(tree.statements);
+  return tree;
+}
+
+auto read(const std::filesystem::path& path) -> std::string {
+  auto&& file = std::ifstream{path, std::ios::binary};
+  return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+auto scripts(const std::filesystem::path& directory) -> std::vector<std::filesystem::path> {
+  auto&& paths = std::vector<std::filesystem::path>{};
+  for (auto&& entry: std::filesystem::directory_iterator{directory}) {
+    if (entry.path().extension() == ".lox") paths.push_back(entry.path());
+  }
+  std::ranges::sort(paths);
+  return paths;
+}
+
+auto options(lox::Engine engine, bool optimize) -> lox::Options {
+  auto&& options = lox::Options{};
+  options.engine = engine;
+  options.optimize = optimize;
+  return options;
+}
+}
+
+auto main() -> int {
+  using enum lox::Engine;
+
+  for (auto&& [expression, value]: FOLDED) {
+    auto&& source = fmt::format("print {};", expression);
+    auto&& tree = optimize(source);
+    auto* literal = std::get_if<lox::Literal*>(&std::get<lox::Print*>(tree.statements[0])->expression);
+    auto&& folded = literal ? fmt::format("{}", (*literal)->value) : "not folded";
+    check(fmt::format("folds {}", expression), folded == value, fmt::format("expected {}, got {}", value, folded));
+  }
+
+  for (auto&& expression: UNFOLDED) {
+    auto&& source = fmt::format("print {};", expression);
+    auto&& tree = optimize(source);
+    auto&& folded = std::holds_alternative<lox::Literal*>(std::get<lox::Print*>(tree.statements[0])->expression);
+    check(fmt::format("keeps {}", expression), !folded);
+  }
+
+  auto&& kept = optimize("if (1 < 2) print 1; else print 2;");
+  check("constant if keeps the live branch", std::holds_alternative<lox::Print*>(kept.statements[0]));
+  auto&& dropped = optimize("if (nil) print 1;");
+  check("constant if without a live branch goes", std::holds_alternative<std::monostate>(dropped.statements[0]));
+  auto&& never = optimize("while (1 > 2) print 1;");
+  check("loop that never runs goes", std::holds_alternative<std::monostate>(never.statements[0]));
+  auto&& forever = optimize("while (!false) print 1;");
+  check("loop forever has no condition", std::holds_alternative<std::monostate>(std::get<lox::While*>(forever.statements[0])->condition));
+
+  auto&& sources = std::vector<std::pair<std::string, std::string>>{};
+  for (auto&& expression: UNFOLDED) {
+    sources.emplace_back(expression, fmt::format("print 1;\nprint {};\nprint 2;\n", expression));
+  }
+  for (auto&& [expression, value]: FOLDED) {
+    sources.emplace_back(expression, fmt::format("var missing = 0;\nprint {};\n", expression));
+  }
+  sources.emplace_back("branches and loops", R"(
+    if (1 < 2) print "live"; else print "dead";
+    if (nil) print -"never raised";
+    while (false) print -"never raised";
+    fun count() {
+      var i = 0;
+      while (true) {
+        i = i + 1;
+        if (i == 3) return i;
+      }
+    }
+    print count();
+  )");
+  for (auto&& directory: {LOX_BENCH_DIR, LOX_EXAMPLE_DIR}) {
+    for (auto&& path: scripts(directory)) sources.emplace_back(path.filename().string(), read(path));
+  }
+
+  for (auto&& [engineName, engine]: std::array{std::pair{"tree", TREE}, std::pair{"closure", CLOSURE}, std::pair{"vm", VM}}) {
+    for (auto&& [name, source]: sources) {
+      auto&& optimized = lox::test::capture(source, options(engine, true));
+      check(fmt::format("{}: {} matches --no-optimize", engineName, name), optimized, lox::test::capture(source, options(engine, false)));
+    }
+  }
+
+  return lox::test::status();
+}
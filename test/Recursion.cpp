@@ -0,0 +1,58 @@
+#include "Lox.hpp"
+#include "Run.hpp"
+#include "Session.hpp"
+
+#include <fmt/format.h>
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Checks that every engine runs ordinary deep recursion to the same result,
+// and that the VM grows its stack well past the depth the tree walker can
+// reach on its thread stack, still reporting unbounded recursion as an
+// error.
+
+namespace {
+using lox::test::check;
+using lox::test::Run;
+
+auto sum(int n) -> std::string {
+  return fmt::format("fun sum(n) {{ if (n == 0) return 0; return n + sum(n - 1); }} print sum({});", n);
+}
+
+auto options(lox::Engine engine) -> lox::Options {
+  auto&& options = lox::Options{};
+  options.engine = engine;
+  return options;
+}
+}
+
+auto main() -> int {
+  using enum lox::Engine;
+  using enum lox::Session::Result;
+  using lox::test::capture;
+
+  // Shallow enough for the tree walker in an unoptimized build.
+  for (auto&& depth: {1000, 2000}) {
+    auto&& expected = capture(sum(depth), options(TREE));
+    check(fmt::format("sum({}) on tree", depth), expected, Run{fmt::format("{}\n", depth * (depth + 1) / 2), "", OK});
+    for (auto&& [name, engine]: std::array{std::pair{"closure", CLOSURE}, std::pair{"vm", VM}}) {
+      check(fmt::format("sum({}) on {} matches tree", depth, name), capture(sum(depth), options(engine)), expected);
+    }
+  }
+
+  auto&& count = "fun count(n) { if (n > 0) count(n - 1); return n; } print count(200000);";
+  check("count(200000) on vm", capture(count, options(VM)), Run{"200000\n", "", OK});
+
+  auto&& unbounded = capture("fun f() { f(); } f();", options(VM));
+  check("unbounded recursion on vm", unbounded, Run{"", "Stack overflow. \n[line 1 ]", RUNTIME_ERROR});
+
+  // A failed run leaves the stack usable for the next one.
+  auto&& session = lox::Session{options(VM), [](std::string_view) {}, [](std::string_view) {}};
+  session.run("fun f() { f(); } f();");
+  check("vm recovers after a stack overflow", session.run(sum(1000)) == OK);
+
+  return lox::test::status();
+}
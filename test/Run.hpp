@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Lox.hpp"
+#include "Session.hpp"
+
+#include <fmt/format.h>
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Helpers shared by the tests: each test is a program that runs Lox source
+// through a Session, reports every check it makes and exits non-zero if any
+// of them failed.
+namespace lox::test {
+// What a run printed, what it reported and how it ended.
+struct Run {
+  std::string output = {};
+  std::string errors = {};
+  Session::Result result = {};
+
+  friend auto operator==(const Run&, const Run&) -> bool = default;
+};
+
+// Runs `source` in a new Session, after `setup` has prepared it.
+inline auto capture(std::string_view source, Options options = {}, const std::function<void(Session&)>& setup = {}) -> Run {
+  auto&& result = Run{};
+  auto&& session = Session{
+    std::move(options),
+    [&](std::string_view text) { result.output += text; },
+    [&](std::string_view text) { result.errors += text; },
+  };
+  if (setup) setup(session);
+  result.result = session.run(source);
+  return result;
+}
+
+inline auto describe(const Run& run) -> std::string {
+  return fmt::format("result {}, output {:?}, errors {:?}", static_cast<int>(run.result), run.output, run.errors);
+}
+
+inline auto failures = 0;
+
+// Reports `name` and counts it as a failure unless `passed`; `detail` is
+// printed for failures only.
+inline auto check(std::string_view name, bool passed, std::string_view detail = {}) -> bool {
+  fmt::print("{:<48} {}\n", name, passed ? "ok" : "FAILED");
+  if (!passed) {
+    if (!detail.empty()) fmt::print("  {}\n", detail);
+    failures++;
+  }
+  return passed;
+}
+
+// Checks that `actual` is the run `expected` describes.
+inline auto check(std::string_view name, const Run& actual, const Run& expected) -> bool {
+  return check(name, actual == expected, fmt::format("expected {}\n  got      {}", describe(expected), describe(actual)));
+}
+
+inline auto status() -> int {
+  return failures == 0 ? 0 : 1;
+}
+}
@@ -0,0 +1,93 @@
+#include "Lox.hpp"
+#include "Run.hpp"
+#include "ScriptCache.hpp"
+#include "Session.hpp"
+#include "Symbol.hpp"
+
+#include <fmt/format.h>
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+// Checks that a cached tree is only loaded for the script it was made for:
+// a stored entry is a hit, and a missing, corrupted or truncated entry, or
+// one left by a different script under the same key, is a miss. Runs that
+// miss still parse the script and print the same output.
+
+namespace {
+using lox::test::check;
+using lox::test::Run;
+
+constexpr auto SOURCE = std::string_view{"var a = 1;\nfun f(x) { return x + a; }\nprint f(2);\n"};
+// Same length as SOURCE, so only the text tells them apart.
+constexpr auto OTHER = std::string_view{"var a = 1;\nfun f(x) { return x - a; }\nprint f(2);\n"};
+
+auto read(const std::filesystem::path& path) -> std::string {
+  auto&& file = std::ifstream{path, std::ios::binary};
+  return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+auto write(const std::filesystem::path& path, std::string_view data) -> void {
+  auto&& file = std::ofstream{path, std::ios::binary | std::ios::trunc};
+  file.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+auto hits(const std::string& directory, std::string_view source) -> bool {
+  auto&& symbols = lox::SymbolTable{};
+  auto&& cache = lox::ScriptCache::forSource(directory, source);
+  return cache.load(source, symbols).has_value();
+}
+}
+
+auto main() -> int {
+  using lox::ScriptCache;
+  using lox::test::capture;
+
+  auto&& directory = (std::filesystem::temp_directory_path() / fmt::format("lox-test-script-cache-{}", ::getpid())).string();
+  std::filesystem::remove_all(directory);
+  auto&& options = lox::Options{};
+  options.cache = directory;
+  auto&& expected = capture(SOURCE);
+  auto&& entry = ScriptCache::forSource(directory, SOURCE).path;
+
+  check("miss runs the script", capture(SOURCE, options), expected);
+  check("miss stores an entry", std::filesystem::exists(entry));
+  check("hit", hits(directory, SOURCE));
+  check("hit runs the script", capture(SOURCE, options), expected);
+  check("other script misses", !hits(directory, OTHER));
+
+  // What a hash collision would leave: the entry for SOURCE under the key
+  // of OTHER, with a valid checksum.
+  auto&& data = read(entry);
+  auto&& other = ScriptCache::forSource(directory, OTHER);
+  auto&& header = ScriptCache::Header{};
+  std::memcpy(&header, data.data(), sizeof header);
+  header.key = other.key;
+  std::memcpy(data.data(), &header, sizeof header);
+  write(other.path, data);
+  check("colliding entry misses", !hits(directory, OTHER));
+  check("colliding entry runs the script", capture(OTHER, options), capture(OTHER));
+
+  data = read(entry);
+  data.back() ^= 1;
+  write(entry, data);
+  check("bad checksum misses", !hits(directory, SOURCE));
+  check("bad checksum runs the script", capture(SOURCE, options), expected);
+  check("bad entry is replaced", hits(directory, SOURCE));
+
+  data = read(entry);
+  for (auto&& size: {data.size() - 1, data.size() / 2, sizeof header + 1, sizeof header - 1, std::size_t{0}}) {
+    write(entry, std::string_view{data}.substr(0, size));
+    check(fmt::format("truncated to {} bytes misses", size), !hits(directory, SOURCE));
+  }
+
+  std::filesystem::remove_all(directory);
+  return lox::test::status();
+}
@@ -0,0 +1,70 @@
+#include "Lox.hpp"
+#include "Run.hpp"
+#include "Session.hpp"
+
+#include <array>
+#include <utility>
+#include <string>
+#include <string_view>
+
+// Checks that --stream runs each declaration before parsing the next, and
+// that once one fails it runs nothing more but still parses and resolves
+// the rest, reporting every static error after it.
+
+namespace {
+using lox::test::check;
+using lox::test::Run;
+
+struct Case {
+  std::string_view name;
+  std::string_view source;
+  std::string_view output;
+  std::string_view errors;
+};
+
+constexpr auto CASES = std::array{
+  Case{"no errors", "print 1;\nprint 2;\n", "1\n2\n", ""},
+  Case{
+    "resolver errors",
+    "print 1;\nreturn 2;\nprint 3;\n{ var b = b; }\nprint 4;\n",
+    "1\n",
+    "[line 2] Error  at 'return': Can't return from top-level code.\n"
+    "[line 4] Error  at 'b': Can't read local variable in its own initializer.\n",
+  },
+  Case{
+    "syntax then resolver error",
+    "print 1;\nprint ;\n{ var b = b; }\nprint 4;\n",
+    "1\n",
+    "[line 2] Error  at ';': Expect expression.\n"
+    "[line 3] Error  at 'b': Can't read local variable in its own initializer.\n",
+  },
+  Case{
+    "runtime then resolver error",
+    "print 1;\nprint -nil;\n{ var b = b; }\nprint 4;\n",
+    "1\n",
+    "Operand must be a number. \n[line 2 ]"
+    "[line 3] Error  at 'b': Can't read local variable in its own initializer.\n",
+  },
+};
+
+auto streamed(lox::Engine engine) -> lox::Options {
+  auto&& options = lox::Options{};
+  options.engine = engine;
+  options.stream = true;
+  return options;
+}
+}
+
+auto main() -> int {
+  using enum lox::Engine;
+  using enum lox::Session::Result;
+
+  for (auto&& [engineName, engine]: std::array{std::pair{"tree", TREE}, std::pair{"closure", CLOSURE}, std::pair{"vm", VM}}) {
+    for (auto&& [name, source, output, errors]: CASES) {
+      auto&& expected = Run{std::string{output}, std::string{errors}, errors.empty() ? OK : STATIC_ERROR};
+      check(fmt::format("{}: {}", engineName, name), lox::test::capture(source, streamed(engine)), expected);
+    }
+  }
+
+  return lox::test::status();
+}